@@ -51,9 +51,27 @@ typedef struct {
     uint8_t *buffer;
 } bitmap_t;
 
+/*
+Maps destination pixels back to source pixels, in 16.16 fixed point.
+Coordinates are taken at pixel centres, so the centre of destination
+pixel (x, y) is at (x + 0.5, y + 0.5) and samples the source at
+u = a * x + b * y + c, v = d * x + e * y + f.
+*/
+typedef struct {
+    int32_t a, b, c;
+    int32_t d, e, f;
+} bitmap_affine_t;
+
+#define BITMAP_AFFINE_ONE       (1 << 16)
+
+#define BITMAP_SAMPLE_NEAREST   (0)
+#define BITMAP_SAMPLE_BILINEAR  (1)
+
 uint32_t bitmap_size(bitmap_t *bitmap);
 void bitmap_init(bitmap_t *bitmap, uint8_t *buffer);
 void bitmap_blit(int16_t x0, int16_t y0, bitmap_t *src, bitmap_t *dst);
 void bitmap_scale_blit(int16_t x0, int16_t y0, uint16_t w, uint16_t h, bitmap_t *src, bitmap_t *dst);
+void bitmap_affine_rotate(bitmap_affine_t *matrix, float angle, float scale, float sx, float sy, float dx, float dy);
+void bitmap_affine_blit(const bitmap_affine_t *matrix, uint8_t sample, bitmap_t *src, bitmap_t *dst);
 
 #endif /* _BITMAP_H */
\ No newline at end of file
@@ -292,6 +292,137 @@ void hagl_draw_polygon(int16_t amount, int16_t *vertices, color_t color);
  */
 void hagl_fill_polygon(int16_t amount, int16_t *vertices, color_t color);
 
+/* Fractional bits of subpixel coordinates. */
+#define HAGL_SUBPIXEL_BITS       (4)
+
+/**
+ * Edge of a polygon being filled
+ *
+ * Only the filler reads or writes these, callers just provide the
+ * storage. x is fixed point, stepping dx per row.
+ */
+typedef struct {
+    int32_t x;
+    int32_t dx;
+    int16_t y1;
+    int16_t next;
+    int8_t winding;
+} hagl_edge_t;
+
+/*
+ * Rows an edge table can hold, the tallest clip window it fills. HALs
+ * which draw into bitmaps taller than the display raise it.
+ */
+#ifndef HAGL_EDGE_ROWS
+#define HAGL_EDGE_ROWS           (DISPLAY_HEIGHT)
+#endif
+
+/* Fill rules for hagl_edge_table_fill(). */
+#define HAGL_FILL_EVEN_ODD       (0)
+#define HAGL_FILL_NONZERO        (1)
+
+/**
+ * Edges of a polygon being built up for filling
+ *
+ * Lets shapes which are not a list of rings, such as the outline of a
+ * stroked line, be filled in one pass. Only the edge table functions
+ * read or write its fields.
+ */
+typedef struct {
+    hagl_edge_t *edges;
+    int16_t bucket[HAGL_EDGE_ROWS];
+    int16_t count;
+    int16_t rows;
+    int16_t first;
+    int16_t cleared;
+    int16_t last;
+} hagl_edge_table_t;
+
+/**
+ * Start an empty edge table
+ *
+ * The clip window is read here, so it must not change until the
+ * table has been filled. Rows past the first HAGL_EDGE_ROWS of the
+ * window are left empty.
+ *
+ * @param table
+ * @param edges scratch space for every edge to be added, at most 32767
+ */
+void hagl_edge_table_init(hagl_edge_table_t *table, hagl_edge_t *edges);
+
+/**
+ * Add an edge to an edge table
+ *
+ * Coordinates are fixed point with HAGL_SUBPIXEL_BITS fractional
+ * bits, pixel centres are half a pixel in from integer coordinates.
+ * The edge winds +1 if it runs down the screen and -1 if it runs up.
+ * Edges which do not cross the centre of a row in the clip window
+ * take no space.
+ *
+ * @param table
+ * @param x0
+ * @param y0
+ * @param x1
+ * @param y1
+ */
+void hagl_edge_table_add(hagl_edge_table_t *table, int32_t x0, int32_t y0, int32_t x1, int32_t y1);
+
+/**
+ * Fill the inside of the edges in an edge table
+ *
+ * Output will be clipped to the current clip window. Under
+ * HAGL_FILL_EVEN_ODD a pixel is inside if a line from it crosses an
+ * odd number of edges. Under HAGL_FILL_NONZERO it is inside if the
+ * windings of the edges crossed do not cancel out, so overlapping
+ * shapes which all wind the same way are filled as their union and
+ * every pixel is drawn once.
+ *
+ * @param table
+ * @param rule HAGL_FILL_EVEN_ODD or HAGL_FILL_NONZERO
+ * @param color
+ */
+void hagl_edge_table_fill(hagl_edge_table_t *table, uint8_t rule, color_t color);
+
+/**
+ * Draw a filled polygon made of one or more rings
+ *
+ * Output will be clipped to the current clip window. Each ring is
+ * closed implicitly, its last vertex joins its first. Rings are
+ * filled together with the even-odd rule, so rings inside another
+ * ring cut holes in it. There is no limit on vertices or crossings
+ * per row, the caller passes scratch space for one edge per vertex.
+ * Pixels are drawn where their centre falls inside the polygon, so
+ * polygons sharing an edge do not overlap.
+ *
+ * color_t color = hagl_color(0, 255, 0);
+ * int16_t vertices[14] = {0, 0, 60, 0, 60, 60, 0, 60, 20, 20, 40, 20, 30, 40};
+ * uint16_t ends[2] = {4, 7};
+ * hagl_edge_t edges[7];
+ * hagl_fill_rings(2, ends, vertices, edges, color);
+ *
+ * @param rings number of rings
+ * @param ends index one past the last vertex of each ring
+ * @param vertices pointer to (an array) of vertices of all rings
+ * @param edges scratch space for ends[rings - 1] edges, at most 32767
+ * @param color
+ */
+void hagl_fill_rings(uint16_t rings, const uint16_t *ends, const int16_t *vertices, hagl_edge_t *edges, color_t color);
+
+/**
+ * Draw a filled convex polygon with vertices placed between pixels
+ *
+ * Output will be clipped to the current clip window. Each coordinate
+ * is fixed point with HAGL_SUBPIXEL_BITS fractional bits, pixel
+ * centres are half a pixel in from integer coordinates. The polygon
+ * is walked down both sides from its top vertex and filled one span
+ * per row, so it must be convex. Vertices may be in either order.
+ *
+ * @param amount number of vertices
+ * @param vertices pointer to (an array) of vertices
+ * @param color
+ */
+void hagl_fill_convex_subpixel(uint16_t amount, const int32_t *vertices, color_t color);
+
 /**
  * Draw a triangle
  *
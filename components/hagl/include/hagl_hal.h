@@ -1,8 +1,12 @@
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <bitmap.h>
+
+#ifdef ESP_PLATFORM
 #include "driver/spi_master.h"
 #include "driver/spi_common.h"
+#endif
 
 typedef uint8_t color_t;
 
@@ -18,6 +22,9 @@ typedef uint8_t color_t;
 #define HAGL_HAS_HAL_HLINE
 #define HAGL_HAS_HAL_VLINE
 
+/* Edge tables cover bitmaps up to this tall, see hagl_hal_set_target(). */
+#define HAGL_EDGE_ROWS  (256)
+
 /**
  * @brief Draw a single pixel
  *
@@ -41,6 +48,21 @@ void hagl_hal_put_pixel(int16_t x0, int16_t y0, color_t color);
  */
 bitmap_t *hagl_hal_init();
 
+/**
+ * @brief Draw into another bitmap
+ *
+ * Points drawing at bitmap instead of the back buffer, so a view
+ * larger than the display can be rendered and blitted later. The
+ * bitmap must have DISPLAY_DEPTH bits per pixel and be at most
+ * HAGL_EDGE_ROWS tall, and the clip window should be set to its
+ * size. Passing NULL goes back to the back buffer. Flushing always
+ * outputs the back buffer.
+ *
+ * @param bitmap bitmap to draw into or NULL
+ * @return the bitmap drawn into until now
+ */
+bitmap_t *hagl_hal_set_target(bitmap_t *bitmap);
+
 /**
  * @brief Output the current frame
  *
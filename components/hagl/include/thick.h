@@ -1,4 +1,61 @@
+#ifndef _HAGL_THICK_H
+#define _HAGL_THICK_H
+
 #include "hagl_hal.h"
+#include "hagl.h"
+
+/**
+ * Draw a thick line
+ *
+ * The line is turned into a quad and filled as horizontal spans, so
+ * every covered pixel is written once. It covers 2t - 1 pixels across
+ * and reaches half a pixel past both end points. Output will be
+ * clipped to the current clip window.
+ *
+ * @param x0
+ * @param y0
+ * @param x1
+ * @param y1
+ * @param t thickness
+ * @param color
+ */
+void draw_thick_line(int16_t x0, int16_t y0, int16_t x1, int16_t y1, int16_t t, color_t color);
+
+/**
+ * Draw the join between two thick lines
+ *
+ * Fills the gap on the outside of the bend where a thick line from
+ * (x0, y0) to (x1, y1) meets one from (x1, y1) to (x2, y2). Joins are
+ * mitered, or beveled where the miter would reach further than the
+ * thickness.
+ *
+ * @param x0
+ * @param y0
+ * @param x1
+ * @param y1
+ * @param x2
+ * @param y2
+ * @param t thickness
+ * @param color
+ */
+void draw_thick_join(int16_t x0, int16_t y0, int16_t x1, int16_t y1, int16_t x2, int16_t y2, int16_t t, color_t color);
 
-void draw_varthick_line(int16_t x0, int16_t y0, int16_t x1, int16_t y1, int16_t t, color_t color);
+/**
+ * Draw a thick line through a list of points
+ *
+ * The outline of the whole line is filled in a single pass under the
+ * nonzero rule, so joins leave no gaps and no pixel is drawn twice.
+ * Joins are mitered as in draw_thick_join(). The two ends reach half a
+ * pixel past the first and last points, unless the last point is the
+ * first again, in which case the line is closed with a join. Output
+ * will be clipped to the current clip window.
+ *
+ * @param amount number of points
+ * @param vertices pointer to (an array) of points
+ * @param t thickness
+ * @param edges scratch space for 6 * amount edges, at most 32767
+ * @param color
+ */
+void draw_thick_polyline(uint16_t amount, const int16_t *vertices, int16_t t, hagl_edge_t *edges, color_t color);
 
+#endif /* _HAGL_THICK_H */
@@ -114,7 +114,8 @@ void bitmap_blit(int16_t x0, int16_t y0, bitmap_t *src, bitmap_t *dst)
 
 /*
  * Blit source bitmap to target bitmap scaling it up or down to given
- * dimensions.
+ * dimensions. The source is stepped through in 16.16 fixed point, one
+ * add per pixel.
  *
  * http://www.tech-algorithm.com/articles/nearest-neighbor-image-scaling
  * http://www.davdata.nl/math/bmresize.html
@@ -122,27 +123,35 @@ void bitmap_blit(int16_t x0, int16_t y0, bitmap_t *src, bitmap_t *dst)
 
 void bitmap_scale_blit(int16_t x0, int16_t y0, uint16_t dstw, uint16_t dsth, bitmap_t *src, bitmap_t *dst)
 {
-    uint16_t px, py;
-
     uint16_t srcw = src->width;
     uint16_t srch = src->height;
-    uint32_t x_ratio = (uint32_t)((srcw << 16) / dstw);
-    uint32_t y_ratio = (uint32_t)((srch << 16) / dsth);
+    uint32_t x_ratio = ((uint32_t)srcw << 16) / dstw;
+    uint32_t y_ratio = ((uint32_t)srch << 16) / dsth;
+    uint32_t x_start = 0;
+    uint32_t y_start = 0;
 
     /* x0 or y0 is over the edge, nothing to do. */
     if ((x0 > dst->width) || (y0 > dst->height)) {
         return;
     }
 
-    /* x0 is negative, ignore parts outside of screen. */
+    /* x0 is negative, skip the columns outside of screen. */
     if (x0 < 0) {
+        if (-x0 >= dstw) {
+            return;
+        }
         dstw = dstw + x0;
+        x_start = (uint32_t)(-x0) * x_ratio;
         x0 = 0;
     }
 
-    /* y0 is negative, ignore parts outside of screen. */
+    /* y0 is negative, skip the rows outside of screen. */
     if (y0 < 0) {
+        if (-y0 >= dsth) {
+            return;
+        }
         dsth = dsth + y0;
+        y_start = (uint32_t)(-y0) * y_ratio;
         y0 = 0;
     }
 
@@ -163,27 +172,236 @@ void bitmap_scale_blit(int16_t x0, int16_t y0, uint16_t dstw, uint16_t dsth, bit
     /* the pointer maths much more easy to read. */
     if (2 == bytes) {
         uint16_t *dstptr = (uint16_t *) (dst->buffer + dst->pitch * y0 + (dst->depth / 8) * x0);
-        uint16_t *srcptr = (uint16_t *) src->buffer;
+        uint32_t py = y_start;
         for (uint16_t y = 0; y < dsth; y++) {
+            uint16_t *srcptr = (uint16_t *) (src->buffer + src->pitch * (py >> 16));
+            uint32_t px = x_start;
             for (uint16_t x = 0; x < dstw; x++) {
-                px = ((x * x_ratio) >> 16);
-                py = ((y * y_ratio) >> 16);
-                *(dstptr++) = srcptr[(uint8_t)((py * srcw) + px)];
+                *(dstptr++) = srcptr[px >> 16];
+                px += x_ratio;
             }
             dstptr += dst->pitch / (dst->depth / 8) - dstw;
+            py += y_ratio;
         }
     /* Assume 1 byte per pixel. */
     } else {
         uint8_t *dstptr = (uint8_t *) (dst->buffer + dst->pitch * y0 + (dst->depth / 8) * x0);
-        uint8_t *srcptr = (uint8_t *) src->buffer;
+        uint32_t py = y_start;
         for (uint16_t y = 0; y < dsth; y++) {
+            uint8_t *srcptr = (uint8_t *) (src->buffer + src->pitch * (py >> 16));
+            uint32_t px = x_start;
             for (uint16_t x = 0; x < dstw; x++) {
-                px = ((x * x_ratio) >> 16);
-                py = ((y * y_ratio) >> 16);
-                *(dstptr++) = srcptr[(uint8_t)((py * srcw) + px)];
+                *(dstptr++) = srcptr[px >> 16];
+                px += x_ratio;
             }
             dstptr += dst->pitch / (dst->depth / 8) - dstw;
+            py += y_ratio;
+        }
+    }
+}
+
+/*
+ * Set up matrix to turn the source by angle radians and scale it by
+ * scale, putting source point (sx, sy) at destination point (dx, dy).
+ * Angles turn the same way as the map is rotated on screen.
+ */
+
+void bitmap_affine_rotate(bitmap_affine_t *matrix, float angle, float scale, float sx, float sy, float dx, float dy)
+{
+    float cos_a = cosf(angle) / scale;
+    float sin_a = sinf(angle) / scale;
+
+    matrix->a = lroundf(cos_a * BITMAP_AFFINE_ONE);
+    matrix->b = lroundf(sin_a * BITMAP_AFFINE_ONE);
+    matrix->c = lroundf((sx - cos_a * dx - sin_a * dy) * BITMAP_AFFINE_ONE);
+    matrix->d = lroundf(-sin_a * BITMAP_AFFINE_ONE);
+    matrix->e = lroundf(cos_a * BITMAP_AFFINE_ONE);
+    matrix->f = lroundf((sy + sin_a * dx - cos_a * dy) * BITMAP_AFFINE_ONE);
+}
+
+/* Largest integer not above n / d. */
+static int64_t floor_div(int64_t n, int64_t d)
+{
+    int64_t q = n / d;
+
+    if ((n % d != 0) && ((n < 0) != (d < 0))) {
+        q--;
+    }
+    return q;
+}
+
+/*
+ * Narrow the span [*x0, *x1) down to the x where lo <= p + s * x < hi,
+ * so the pixels inside never need checking.
+ */
+static void bitmap_clip_span(int64_t p, int32_t s, int64_t lo, int64_t hi, int32_t *x0, int32_t *x1)
+{
+    int64_t first;
+    int64_t end;
+
+    if (s == 0) {
+        if ((p < lo) || (p >= hi)) {
+            *x1 = *x0;
         }
+        return;
+    }
+
+    if (s > 0) {
+        first = -floor_div(p - lo, s);
+        end = -floor_div(p - hi, s);
+    } else {
+        first = floor_div(hi - p, s) + 1;
+        end = floor_div(lo - p, s) + 1;
+    }
+
+    if (first > *x0) {
+        *x0 = (first < *x1) ? first : *x1;
+    }
+    if (end < *x1) {
+        *x1 = (end > *x0) ? end : *x0;
     }
 }
 
+/*
+ * Blend four pixels, weighted by fx and fy out of 256 across and down.
+ * Each colour field is blended in place under its mask.
+ */
+static inline uint32_t bitmap_blend_field(uint32_t c00, uint32_t c10, uint32_t c01, uint32_t c11, uint32_t fx, uint32_t fy, uint32_t mask)
+{
+    uint32_t top = (c00 & mask) * (256 - fx) + (c10 & mask) * fx;
+    uint32_t bottom = (c01 & mask) * (256 - fx) + (c11 & mask) * fx;
+
+    return ((top * (256 - fy) + bottom * fy) >> 16) & mask;
+}
+
+static inline uint8_t bitmap_blend_rgb332(uint8_t c00, uint8_t c10, uint8_t c01, uint8_t c11, uint32_t fx, uint32_t fy)
+{
+    return bitmap_blend_field(c00, c10, c01, c11, fx, fy, 0xe0) |
+        bitmap_blend_field(c00, c10, c01, c11, fx, fy, 0x1c) |
+        bitmap_blend_field(c00, c10, c01, c11, fx, fy, 0x03);
+}
+
+static inline uint16_t swap16(uint16_t value)
+{
+    return (value << 8) | (value >> 8);
+}
+
+/* Pixels are RGB565 in the byte order rgb565() gives. */
+static inline uint16_t bitmap_blend_rgb565(uint16_t c00, uint16_t c10, uint16_t c01, uint16_t c11, uint32_t fx, uint32_t fy)
+{
+    c00 = swap16(c00);
+    c10 = swap16(c10);
+    c01 = swap16(c01);
+    c11 = swap16(c11);
+
+    return swap16(
+        bitmap_blend_field(c00, c10, c01, c11, fx, fy, 0xf800) |
+        bitmap_blend_field(c00, c10, c01, c11, fx, fy, 0x07e0) |
+        bitmap_blend_field(c00, c10, c01, c11, fx, fy, 0x001f)
+    );
+}
+
+/*
+ * Blit source bitmap to target bitmap through an affine transform, so
+ * it can be turned, scaled and moved in one pass. Each destination row
+ * is clipped up front to the span which lands inside the source, then
+ * walked adding the matrix steps to the source position. Destination
+ * pixels landing outside the source are left alone. Both bitmaps must
+ * have the same depth, 8 bit pixels are RGB332 and 16 bit pixels are
+ * RGB565 in the byte order rgb565() gives. The source can be at most
+ * 32767 pixels across.
+ */
+
+void bitmap_affine_blit(const bitmap_affine_t *matrix, uint8_t sample, bitmap_t *src, bitmap_t *dst)
+{
+    /*
+     * Held in locals, as every store through a byte pointer could
+     * otherwise change them.
+     */
+    const uint8_t *srcbuf = src->buffer;
+    int32_t srcpitch = src->pitch;
+    int32_t srcw = src->width;
+    int32_t srch = src->height;
+    int32_t step_u = matrix->a;
+    int32_t step_v = matrix->d;
+
+    /* Bytes per pixel. */
+    uint8_t bytes = dst->depth / 8;
+
+    if ((src->depth != dst->depth) || ((bytes != 1) && (bytes != 2))) {
+        return;
+    }
+
+    for (int32_t y = 0; y < dst->height; y++) {
+        /* Source position of the centre of the first pixel in the row. */
+        int64_t u = matrix->c + (step_u + (int64_t)matrix->b * (2 * y + 1)) / 2;
+        int64_t v = matrix->f + (step_v + (int64_t)matrix->e * (2 * y + 1)) / 2;
+        int32_t x0 = 0;
+        int32_t x1 = dst->width;
+
+        bitmap_clip_span(u, step_u, 0, (int64_t)srcw << 16, &x0, &x1);
+        bitmap_clip_span(v, step_v, 0, (int64_t)srch << 16, &x0, &x1);
+
+        if (x0 >= x1) {
+            continue;
+        }
+
+        int32_t su = u + (int64_t)step_u * x0;
+        int32_t sv = v + (int64_t)step_v * x0;
+        uint8_t *dstptr = dst->buffer + dst->pitch * y + bytes * x0;
+
+        if (BITMAP_SAMPLE_BILINEAR == sample) {
+            /*
+             * Blend the four pixels around the sample point, which is
+             * half a pixel up and left of pixel centres. Neighbours off
+             * the edge of the source repeat the edge pixel.
+             */
+            for (int32_t x = x0; x < x1; x++) {
+                int32_t bu = su - BITMAP_AFFINE_ONE / 2;
+                int32_t bv = sv - BITMAP_AFFINE_ONE / 2;
+                int32_t i0 = bu >> 16;
+                int32_t j0 = bv >> 16;
+                int32_t i1 = (i0 + 1 < srcw) ? i0 + 1 : i0;
+                int32_t j1 = (j0 + 1 < srch) ? j0 + 1 : j0;
+                uint32_t fx = (bu >> 8) & 0xff;
+                uint32_t fy = (bv >> 8) & 0xff;
+
+                if (i0 < 0) {
+                    i0 = 0;
+                }
+                if (j0 < 0) {
+                    j0 = 0;
+                }
+
+                const uint8_t *row0 = srcbuf + srcpitch * j0;
+                const uint8_t *row1 = srcbuf + srcpitch * j1;
+
+                if (2 == bytes) {
+                    const uint16_t *top = (const uint16_t *)row0;
+                    const uint16_t *bottom = (const uint16_t *)row1;
+                    *((uint16_t *)dstptr) = bitmap_blend_rgb565(top[i0], top[i1], bottom[i0], bottom[i1], fx, fy);
+                } else {
+                    *dstptr = bitmap_blend_rgb332(row0[i0], row0[i1], row1[i0], row1[i1], fx, fy);
+                }
+
+                dstptr += bytes;
+                su += step_u;
+                sv += step_v;
+            }
+        } else if (2 == bytes) {
+            uint16_t *ptr = (uint16_t *)dstptr;
+            for (int32_t x = x0; x < x1; x++) {
+                *(ptr++) = ((const uint16_t *)(srcbuf + srcpitch * (sv >> 16)))[su >> 16];
+                su += step_u;
+                sv += step_v;
+            }
+        /* Assume 1 byte per pixel. */
+        } else {
+            for (int32_t x = x0; x < x1; x++) {
+                *(dstptr++) = srcbuf[srcpitch * (sv >> 16) + (su >> 16)];
+                su += step_u;
+                sv += step_v;
+            }
+        }
+    }
+}
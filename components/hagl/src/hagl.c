@@ -452,16 +452,19 @@ void hagl_scale_blit(uint16_t x0, uint16_t y0, uint16_t w, uint16_t h, bitmap_t
 #else
     color_t color;
     color_t *ptr = (color_t *) source->buffer;
-    uint32_t x_ratio = (uint32_t)((source->width << 16) / w);
-    uint32_t y_ratio = (uint32_t)((source->height << 16) / h);
+    uint32_t x_ratio = ((uint32_t)source->width << 16) / w;
+    uint32_t y_ratio = ((uint32_t)source->height << 16) / h;
+    uint32_t py = 0;
 
     for (uint16_t y = 0; y < h; y++) {
+        color_t *row = ptr + (py >> 16) * source->width;
+        uint32_t px = 0;
         for (uint16_t x = 0; x < w; x++) {
-            uint16_t px = ((x * x_ratio) >> 16);
-            uint16_t py = ((y * y_ratio) >> 16);
-            color = ptr[(uint8_t)((py * source->width) + px)];
+            color = row[px >> 16];
             hagl_put_pixel(x0 + x, y0 + y, color);
+            px += x_ratio;
         }
+        py += y_ratio;
     }
 #endif
 };
@@ -770,6 +773,357 @@ void hagl_fill_polygon(int16_t amount, int16_t *vertices, color_t color) {
     }
 }
 
+/*
+ * Fractional bits of hagl_edge_t x. Twelve keeps any int16 vertex and
+ * the step of any edge within 32 bits.
+ */
+#define HAGL_EDGE_FRAC  (12)
+#define HAGL_EDGE_ONE   (1 << HAGL_EDGE_FRAC)
+#define HAGL_SUBPIXEL_ONE   (1 << HAGL_SUBPIXEL_BITS)
+
+/*
+ * Edges are listed by the row they start on. Only the buckets from first
+ * up to cleared are valid, so small polygons do not pay for clearing the
+ * whole window.
+ */
+void hagl_edge_table_init(hagl_edge_table_t *table, hagl_edge_t *edges) {
+    table->edges = edges;
+    table->count = 0;
+    table->rows = min(clip_window.y1 - clip_window.y0 + 1, HAGL_EDGE_ROWS);
+    table->first = table->rows;
+    table->cleared = 0;
+    table->last = 0;
+}
+
+void hagl_edge_table_add(hagl_edge_table_t *table, int32_t x0, int32_t y0, int32_t x1, int32_t y1) {
+    int8_t winding = 1;
+
+    y0 -= clip_window.y0 * HAGL_SUBPIXEL_ONE;
+    y1 -= clip_window.y0 * HAGL_SUBPIXEL_ONE;
+
+    if (y0 > y1) {
+        winding = -1;
+        int32_t swap = x0;
+        x0 = x1;
+        x1 = swap;
+        swap = y0;
+        y0 = y1;
+        y1 = swap;
+    }
+
+    /* First row whose centre is on or below y0, and the same for y1. */
+    int32_t top = (y0 + HAGL_SUBPIXEL_ONE / 2 - 1) >> HAGL_SUBPIXEL_BITS;
+    int32_t bottom = (y1 + HAGL_SUBPIXEL_ONE / 2 - 1) >> HAGL_SUBPIXEL_BITS;
+
+    if ((top == bottom) || (bottom <= 0) || (top >= table->rows)) {
+        return;
+    }
+
+    /*
+     * x is kept half a pixel to the left of the crossing, so rounding
+     * it up gives the first pixel whose centre is inside.
+     */
+    hagl_edge_t *edge = &table->edges[table->count];
+    int64_t x = (int64_t)x0 * (HAGL_EDGE_ONE / HAGL_SUBPIXEL_ONE) - HAGL_EDGE_ONE / 2;
+    int32_t centre = top * HAGL_SUBPIXEL_ONE + HAGL_SUBPIXEL_ONE / 2;
+
+    /* Most edges are short enough to keep the division in 32 bits. */
+    if ((x1 - x0 < (1 << 19)) && (x0 - x1 < (1 << 19))) {
+        edge->dx = (x1 - x0) * HAGL_EDGE_ONE / (y1 - y0);
+    } else {
+        edge->dx = (int64_t)(x1 - x0) * HAGL_EDGE_ONE / (y1 - y0);
+    }
+    x += (int64_t)(centre - y0) * edge->dx / HAGL_SUBPIXEL_ONE;
+
+    /* Start at the top of the clip window. */
+    if (top < 0) {
+        x -= (int64_t)top * edge->dx;
+        top = 0;
+    }
+
+    if (table->first >= table->cleared) {
+        table->first = top;
+        table->cleared = top;
+    }
+    while (top < table->first) {
+        table->bucket[--table->first] = -1;
+    }
+    while (top >= table->cleared) {
+        table->bucket[table->cleared++] = -1;
+    }
+
+    edge->x = x;
+    edge->y1 = (bottom > table->rows) ? table->rows : bottom;
+    edge->winding = winding;
+    edge->next = table->bucket[top];
+    table->bucket[top] = table->count++;
+
+    if (edge->y1 > table->last) {
+        table->last = edge->y1;
+    }
+}
+
+/* Insert edge e into the list at *head, keeping it sorted by x. */
+static void hagl_edge_insert(hagl_edge_t *edges, int16_t *head, int16_t e) {
+    int16_t *link = head;
+
+    while (*link >= 0 && edges[*link].x < edges[e].x) {
+        link = &edges[*link].next;
+    }
+
+    edges[e].next = *link;
+    *link = e;
+}
+
+void hagl_edge_table_fill(hagl_edge_table_t *table, uint8_t rule, color_t color) {
+    hagl_edge_t *edges = table->edges;
+    int16_t active = -1;
+
+    for (int16_t y = table->first; y < table->last; y++) {
+        int16_t e = (y < table->cleared) ? table->bucket[y] : -1;
+        int16_t *link = &active;
+        int32_t previous = INT32_MIN;
+        bool sorted = true;
+
+        /*
+         * Edges starting on this row are sorted on their own and then
+         * merged into the active list in one pass, so a row where many
+         * edges start does not walk the list for each of them.
+         */
+        if (e >= 0) {
+            int16_t start = -1;
+
+            while (e >= 0) {
+                int16_t next = edges[e].next;
+                hagl_edge_insert(edges, &start, e);
+                e = next;
+            }
+
+            int16_t *merge = &active;
+            while (start >= 0) {
+                while (*merge >= 0 && edges[*merge].x < edges[start].x) {
+                    merge = &edges[*merge].next;
+                }
+                int16_t next = edges[start].next;
+                edges[start].next = *merge;
+                *merge = start;
+                merge = &edges[start].next;
+                start = next;
+            }
+        }
+
+        /*
+         * Spans start where the count of crossings leaves zero and end
+         * where it comes back. Even-odd only counts to one.
+         */
+        int16_t count = 0;
+        int32_t x0 = 0;
+
+        for (e = active; e >= 0; e = edges[e].next) {
+            int16_t was = count;
+
+            if (rule == HAGL_FILL_NONZERO) {
+                count += edges[e].winding;
+            } else {
+                count ^= 1;
+            }
+
+            if (!was) {
+                x0 = (edges[e].x + HAGL_EDGE_ONE - 1) >> HAGL_EDGE_FRAC;
+            } else if (!count) {
+                int32_t x1 = (edges[e].x + HAGL_EDGE_ONE - 1) >> HAGL_EDGE_FRAC;
+
+                x0 = max(x0, clip_window.x0);
+                x1 = min(x1, clip_window.x1 + 1);
+
+                if (x1 > x0) {
+#ifdef HAGL_HAS_HAL_HLINE
+                    hagl_hal_hline(x0, clip_window.y0 + y, x1 - x0, color);
+#else
+                    hagl_draw_line(x0, clip_window.y0 + y, x1 - 1, clip_window.y0 + y, color);
+#endif
+                }
+            }
+        }
+
+        /* Step to the next row, dropping edges which end here. */
+        while (*link >= 0) {
+            hagl_edge_t *edge = &edges[*link];
+
+            if (edge->y1 == y + 1) {
+                *link = edge->next;
+                continue;
+            }
+
+            edge->x += edge->dx;
+            if (edge->x < previous) {
+                sorted = false;
+            }
+            previous = edge->x;
+            link = &edge->next;
+        }
+
+        /*
+         * Edges which crossed are put back in order with an insertion
+         * sort. Edges still in order are appended to the tail, so only
+         * the few which moved are searched for.
+         */
+        if (!sorted) {
+            int16_t tail = -1;
+
+            e = active;
+            active = -1;
+
+            while (e >= 0) {
+                int16_t next = edges[e].next;
+
+                if ((tail >= 0) && (edges[e].x >= edges[tail].x)) {
+                    edges[e].next = -1;
+                    edges[tail].next = e;
+                    tail = e;
+                } else {
+                    hagl_edge_insert(edges, &active, e);
+                    if (edges[e].next < 0) {
+                        tail = e;
+                    }
+                }
+                e = next;
+            }
+        }
+    }
+}
+
+void hagl_fill_rings(uint16_t rings, const uint16_t *ends, const int16_t *vertices, hagl_edge_t *edges, color_t color) {
+    hagl_edge_table_t table;
+    uint16_t start = 0;
+
+    hagl_edge_table_init(&table, edges);
+
+    for (uint16_t r = 0; r < rings; r++) {
+        for (uint16_t i = start; i < ends[r]; i++) {
+            uint16_t j = (i + 1 == ends[r]) ? start : i + 1;
+            hagl_edge_table_add(
+                &table,
+                vertices[i << 1] * HAGL_SUBPIXEL_ONE,
+                vertices[(i << 1) + 1] * HAGL_SUBPIXEL_ONE,
+                vertices[j << 1] * HAGL_SUBPIXEL_ONE,
+                vertices[(j << 1) + 1] * HAGL_SUBPIXEL_ONE
+            );
+        }
+        start = ends[r];
+    }
+
+    hagl_edge_table_fill(&table, HAGL_FILL_EVEN_ODD, color);
+}
+
+/* One side of a convex polygon, followed down from its top vertex. */
+typedef struct {
+    const int32_t *vertices;
+    uint16_t amount;
+    uint16_t vertex;
+    int8_t direction;
+    int32_t x;
+    int32_t dx;
+    int32_t bottom;
+} hagl_chain_t;
+
+/*
+ * Move on to the edge of the chain which crosses row y, with x at the
+ * centre of that row. Returns false when the chain has run out.
+ */
+static bool hagl_chain_enter(hagl_chain_t *chain, int32_t y, uint16_t last) {
+    while (chain->bottom <= y) {
+        if (chain->vertex == last) {
+            return false;
+        }
+
+        uint16_t next = (chain->vertex + chain->amount + chain->direction) % chain->amount;
+        int32_t x0 = chain->vertices[chain->vertex << 1];
+        int32_t y0 = chain->vertices[(chain->vertex << 1) + 1];
+        int32_t x1 = chain->vertices[next << 1];
+        int32_t y1 = chain->vertices[(next << 1) + 1];
+
+        chain->vertex = next;
+        chain->bottom = (y1 + HAGL_SUBPIXEL_ONE / 2 - 1) >> HAGL_SUBPIXEL_BITS;
+
+        if ((chain->bottom > y) && (y1 > y0)) {
+            int32_t centre = y * HAGL_SUBPIXEL_ONE + HAGL_SUBPIXEL_ONE / 2;
+
+            chain->dx = (int64_t)(x1 - x0) * HAGL_EDGE_ONE / (y1 - y0);
+            chain->x = (int64_t)x0 * (HAGL_EDGE_ONE / HAGL_SUBPIXEL_ONE) - HAGL_EDGE_ONE / 2 +
+                (int64_t)(centre - y0) * chain->dx / HAGL_SUBPIXEL_ONE;
+        }
+    }
+
+    return true;
+}
+
+void hagl_fill_convex_subpixel(uint16_t amount, const int32_t *vertices, color_t color) {
+    uint16_t top = 0;
+    uint16_t bottom = 0;
+    int32_t x0 = INT32_MAX;
+    int32_t x1 = INT32_MIN;
+
+    if (amount < 3) {
+        return;
+    }
+
+    for (uint16_t i = 0; i < amount; i++) {
+        x0 = min(x0, vertices[i << 1]);
+        x1 = max(x1, vertices[i << 1]);
+        if (vertices[(i << 1) + 1] < vertices[(top << 1) + 1]) {
+            top = i;
+        }
+        if (vertices[(i << 1) + 1] > vertices[(bottom << 1) + 1]) {
+            bottom = i;
+        }
+    }
+
+    /* Rows whose centres are inside, cut to the clip window. */
+    int32_t y0 = (vertices[(top << 1) + 1] + HAGL_SUBPIXEL_ONE / 2 - 1) >> HAGL_SUBPIXEL_BITS;
+    int32_t y1 = (vertices[(bottom << 1) + 1] + HAGL_SUBPIXEL_ONE / 2 - 1) >> HAGL_SUBPIXEL_BITS;
+
+    if ((x1 < clip_window.x0 * HAGL_SUBPIXEL_ONE) || (x0 > (clip_window.x1 + 1) * HAGL_SUBPIXEL_ONE)) {
+        return;
+    }
+
+    y0 = max(y0, clip_window.y0);
+    y1 = min(y1, clip_window.y1 + 1);
+
+    hagl_chain_t left = {vertices, amount, top, -1, 0, 0, INT32_MIN};
+    hagl_chain_t right = {vertices, amount, top, 1, 0, 0, INT32_MIN};
+
+    for (int32_t y = y0; y < y1; y++) {
+        if (!hagl_chain_enter(&left, y, bottom) || !hagl_chain_enter(&right, y, bottom)) {
+            return;
+        }
+
+        /* Either chain may be the left one, depending on winding. */
+        int32_t xa = (left.x + HAGL_EDGE_ONE - 1) >> HAGL_EDGE_FRAC;
+        int32_t xb = (right.x + HAGL_EDGE_ONE - 1) >> HAGL_EDGE_FRAC;
+
+        if (xa > xb) {
+            int32_t swap = xa;
+            xa = xb;
+            xb = swap;
+        }
+
+        xa = max(xa, clip_window.x0);
+        xb = min(xb, clip_window.x1 + 1);
+
+        if (xb > xa) {
+#ifdef HAGL_HAS_HAL_HLINE
+            hagl_hal_hline(xa, y, xb - xa, color);
+#else
+            hagl_draw_line(xa, y, xb - 1, y, color);
+#endif
+        }
+
+        left.x += left.dx;
+        right.x += right.dx;
+    }
+}
+
 void hagl_draw_triangle(int16_t x0, int16_t y0, int16_t x1, int16_t y1, int16_t x2, int16_t y2, color_t color) {
     int16_t vertices[6] = {x0, y0, x1, y1, x2, y2};
     hagl_draw_polygon(3, vertices, color);
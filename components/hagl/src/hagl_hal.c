@@ -18,6 +18,8 @@ static bitmap_t fb = {
     .depth = DISPLAY_DEPTH,
 };
 
+static bitmap_t *target = &fb;
+
 bitmap_t *hagl_hal_init()
 {
     bitmap_init(&fb, buffer1);
@@ -25,6 +27,14 @@ bitmap_t *hagl_hal_init()
     return &fb;
 }
 
+bitmap_t *hagl_hal_set_target(bitmap_t *bitmap)
+{
+    bitmap_t *previous = target;
+
+    target = bitmap ? bitmap : &fb;
+    return previous;
+}
+
 size_t hagl_hal_flush()
 {
     display_update(buffer1);
@@ -33,7 +43,7 @@ size_t hagl_hal_flush()
 
 void hagl_hal_put_pixel(int16_t x0, int16_t y0, color_t color)
 {
-    buffer1[DISPLAY_WIDTH*y0 + x0] = color;
+    target->buffer[target->pitch*y0 + x0] = color;
 }
 
 color_t hagl_hal_color(uint8_t r, uint8_t g, uint8_t b) {
@@ -42,14 +52,19 @@ color_t hagl_hal_color(uint8_t r, uint8_t g, uint8_t b) {
 
 void hagl_hal_hline(int16_t x0, int16_t y0, uint16_t width, color_t color)
 {
+    uint8_t *ptr = target->buffer + target->pitch*y0 + x0;
+
     for (uint16_t x = 0; x < width; x++) {
-        buffer1[DISPLAY_WIDTH*y0 + x0+x] = color;
+        ptr[x] = color;
     }
 }
 
 void hagl_hal_vline(int16_t x0, int16_t y0, uint16_t height, color_t color)
 {
+    uint8_t *ptr = target->buffer + target->pitch*y0 + x0;
+    uint32_t pitch = target->pitch;
+
     for (uint16_t y = 0; y < height; y++) {
-        buffer1[DISPLAY_WIDTH*(y0+y) + x0] = color;
+        ptr[pitch*y] = color;
     }
 }
\ No newline at end of file
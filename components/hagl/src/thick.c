@@ -1,241 +1,340 @@
 #include "thick.h"
-#include <math.h>
 #include <hagl_hal.h>
+#include <stdbool.h>
 #include <hagl.h>
 
-/***********************************************************************
- *                                                                     *
- *                            X BASED LINES                            *
- *                                                                     *
- ***********************************************************************/
-
-static void x_perpendicular(int16_t x0,int16_t y0,int16_t dx,int16_t dy,int16_t xstep, int16_t ystep,int16_t einit,int16_t t,int16_t winit, color_t color)
-{
-  int16_t x,y,threshold,E_diag,E_square;
-  int16_t tk;
-  int16_t error;
-  int16_t p,q;
-
-  threshold = dx - 2*dy;
-  E_diag= -2*dx;
-  E_square= 2*dy;
-  p=q=0;
-
-  y= y0;
-  x= x0;
-  error= einit;
-  tk= dx+dy-winit; 
-
-  while(tk<=t)
-  {
-     hagl_put_pixel(x,y, color);
-     if (error>=threshold)
-     {
-       x= x + xstep;
-       error = error + E_diag;
-       tk= tk + 2*dy;
-     }
-     error = error + E_square;
-     y= y + ystep;
-     tk= tk + 2*dx;
-     q++;
-  }
-
-  y= y0;
-  x= x0;
-  error= -einit;
-  tk= dx+dy+winit;
-
-  while(tk<=t)
-  {
-     if (p)
-       hagl_put_pixel(x,y, color);
-     if (error>threshold)
-     {
-       x= x - xstep;
-       error = error + E_diag;
-       tk= tk + 2*dy;
-     }
-     error = error + E_square;
-     y= y - ystep;
-     tk= tk + 2*dx;
-     p++;
-  }
-
-  if (q==0 && p<2) hagl_put_pixel(x0,y0,color); // we need this for very thin lines
+#define THICK_ONE   (1 << HAGL_SUBPIXEL_BITS)
+
+static uint16_t isqrt(uint32_t value) {
+    uint32_t root = 0;
+    uint32_t bit = (uint32_t)1 << 30;
+
+    while (bit > value) {
+        bit >>= 2;
+    }
+
+    while (bit) {
+        if (value >= root + bit) {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+
+    return root;
 }
 
+/*
+ * Offset across the line from (x0, y0) to (x1, y1), half its thickness
+ * long, in subpixels. Returns 0 for a line of no length.
+ */
+static int8_t thick_normal(int16_t x0, int16_t y0, int16_t x1, int16_t y1, int32_t half, int32_t *nx, int32_t *ny) {
+    int32_t dx = x1 - x0;
+    int32_t dy = y1 - y0;
+    uint64_t square = ((uint64_t)dx * dx + (uint64_t)dy * dy) << (2 * HAGL_SUBPIXEL_BITS);
+    uint8_t shift = 0;
+
+    /* Long lines lose a little precision to keep the root in 32 bits. */
+    while (square >> 32) {
+        square >>= 2;
+        shift++;
+    }
 
-static void x_varthick_line(int16_t x0,int16_t y0,int16_t dx,int16_t dy,int16_t xstep, int16_t ystep, int16_t t, int16_t pxstep,int16_t pystep,color_t color)
-{
-  int16_t p_error, error, x,y, threshold, E_diag, E_square, length, p;
-  double D;
-
-
-  p_error= 0;
-  error= 0;
-  y= y0;
-  x= x0;
-  threshold = dx - 2*dy;
-  E_diag= -2*dx;
-  E_square= 2*dy;
-  length = dx+1;
-  D= sqrt(dx*dx+dy*dy);
-
-  for(p=0;p<length;p++)
-  {
-    x_perpendicular(x,y, dx, dy, pxstep, pystep,p_error,t*2*D,error,color);
-    if (error>=threshold)
-    {
-      y= y + ystep;
-      error = error + E_diag;
-      if (p_error>=threshold) 
-      {
-        x_perpendicular(x,y, dx, dy, pxstep, pystep,(p_error+E_diag+E_square),t*2*D,error,color);
-        p_error= p_error + E_diag;
-      }
-      p_error= p_error + E_square;
-    }
-    error = error + E_square;
-    x= x + xstep;
-  }
+    uint32_t length = (uint32_t)isqrt(square) << shift;
+
+    if (length == 0) {
+        return 0;
+    }
+
+    if ((ABS(dx) < 2048) && (ABS(dy) < 2048) && (half < 4096)) {
+        *nx = -dy * half * THICK_ONE / (int32_t)length;
+        *ny = dx * half * THICK_ONE / (int32_t)length;
+    } else {
+        *nx = -(int64_t)dy * half * THICK_ONE / length;
+        *ny = (int64_t)dx * half * THICK_ONE / length;
+    }
+
+    return 1;
 }
 
-/***********************************************************************
- *                                                                     *
- *                            Y BASED LINES                            *
- *                                                                     *
- ***********************************************************************/
-
-static void y_perpendicular(int16_t x0,int16_t y0,int16_t dx,int16_t dy,int16_t xstep, int16_t ystep, int16_t einit,int16_t t,int16_t winit,color_t color)
-{
-  int16_t x,y,threshold,E_diag,E_square;
-  int16_t tk;
-  int16_t error;
-  int16_t p,q;
-
-  p=q= 0;
-  threshold = dy - 2*dx;
-  E_diag= -2*dy;
-  E_square= 2*dx;
-
-  y= y0;
-  x= x0;
-  error= -einit;
-  tk= dx+dy+winit; 
-
-  while(tk<=t)
-  {
-     hagl_put_pixel(x,y, color);
-     if (error>threshold)
-     {
-       y= y + ystep;
-       error = error + E_diag;
-       tk= tk + 2*dx;
-     }
-     error = error + E_square;
-     x= x + xstep;
-     tk= tk + 2*dy;
-     q++;
-  }
-
-
-  y= y0;
-  x= x0;
-  error= einit;
-  tk= dx+dy-winit; 
-
-  while(tk<=t)
-  {
-     if (p)
-       hagl_put_pixel(x,y, color);
-     if (error>=threshold)
-     {
-       y= y - ystep;
-       error = error + E_diag;
-       tk= tk + 2*dx;
-     }
-     error = error + E_square;
-     x= x - xstep;
-     tk= tk + 2*dy;
-     p++;
-  }
-
-  if (q==0 && p<2) hagl_put_pixel(x0,y0,color); // we need this for very thin lines
+void draw_thick_line(int16_t x0, int16_t y0, int16_t x1, int16_t y1, int16_t t, color_t color) {
+    int32_t nx;
+    int32_t ny;
+
+    /* Half the thickness, in subpixels. */
+    int32_t half = t * THICK_ONE - THICK_ONE / 2;
+
+    if ((t < 1) || !thick_normal(x0, y0, x1, y1, half, &nx, &ny)) {
+        return;
+    }
+
+    /* Half a pixel along the line, turning the normal a quarter back. */
+    int32_t ex = ny * (THICK_ONE / 2) / half;
+    int32_t ey = -nx * (THICK_ONE / 2) / half;
+
+    /* End points at pixel centres. */
+    int32_t ax = x0 * THICK_ONE + THICK_ONE / 2 - ex;
+    int32_t ay = y0 * THICK_ONE + THICK_ONE / 2 - ey;
+    int32_t bx = x1 * THICK_ONE + THICK_ONE / 2 + ex;
+    int32_t by = y1 * THICK_ONE + THICK_ONE / 2 + ey;
+
+    int32_t vertices[8] = {
+        ax + nx, ay + ny,
+        bx + nx, by + ny,
+        bx - nx, by - ny,
+        ax - nx, ay - ny
+    };
+    hagl_fill_convex_subpixel(4, vertices, color);
+}
+
+/*
+ * Outline of the join at (cx, cy) between lines with normals a and b,
+ * on the outside of the bend. Returns the number of vertices, 0 if the
+ * lines do not bend.
+ */
+static uint8_t thick_join(int32_t cx, int32_t cy, int32_t ax, int32_t ay, int32_t bx, int32_t by, int32_t half, int32_t *vertices) {
+    /* Normals turn with their lines, so bend the same way. */
+    int64_t cross = (int64_t)ax * by - (int64_t)ay * bx;
+
+    if (cross == 0) {
+        return 0;
+    }
+
+    /* Turn the normals to the outside of the bend. */
+    if (cross > 0) {
+        ax = -ax;
+        ay = -ay;
+        bx = -bx;
+        by = -by;
+    }
+
+    vertices[0] = cx;
+    vertices[1] = cy;
+    vertices[2] = cx + ax;
+    vertices[3] = cy + ay;
+    vertices[4] = cx + bx;
+    vertices[5] = cy + by;
+
+    /*
+     * The miter tip lies along the sum of the normals, as far out as
+     * the join is sharp. Past twice the half thickness it is cut off
+     * to a bevel.
+     */
+    int32_t mx = ax + bx;
+    int32_t my = ay + by;
+    int32_t along = ax * mx + ay * my;
+
+    if (2 * along < half * half) {
+        return 3;
+    }
+
+    vertices[4] = cx + (int64_t)mx * half * half / along;
+    vertices[5] = cy + (int64_t)my * half * half / along;
+    vertices[6] = cx + bx;
+    vertices[7] = cy + by;
+
+    return 4;
 }
 
+void draw_thick_join(int16_t x0, int16_t y0, int16_t x1, int16_t y1, int16_t x2, int16_t y2, int16_t t, color_t color) {
+    int32_t ax, ay;
+    int32_t bx, by;
+    int32_t vertices[8];
+    int32_t half = t * THICK_ONE - THICK_ONE / 2;
+    int64_t cross = (int64_t)(x1 - x0) * (y2 - y1) - (int64_t)(y1 - y0) * (x2 - x1);
+    int64_t dot = (int64_t)(x1 - x0) * (x2 - x1) + (int64_t)(y1 - y0) * (y2 - y1);
 
-static void y_varthick_line(int16_t x0,int16_t y0,int16_t dx,int16_t dy,int16_t xstep, int16_t ystep, int16_t t, int16_t pxstep,int16_t pystep, color_t color) {
-  int16_t p_error, error, x,y, threshold, E_diag, E_square, length, p;
-  double D;
-
-  p_error= 0;
-  error= 0;
-  y= y0;
-  x= x0;
-  threshold = dy - 2*dx;
-  E_diag= -2*dy;
-  E_square= 2*dx;
-  length = dy+1;
-  D= sqrt(dx*dx+dy*dy);
-
-  for(p=0;p<length;p++)
-  {
-    y_perpendicular(x,y, dx, dy, pxstep, pystep,p_error,t*2*D,error,color);
-    if (error>=threshold)
-    {
-      x= x + xstep;
-      error = error + E_diag;
-      if (p_error>=threshold)
-      {
-        y_perpendicular(x,y, dx, dy, pxstep, pystep, p_error+E_diag+E_square,t*2*D,error,color);
-        p_error= p_error + E_diag;
-      }
-      p_error= p_error + E_square;
-    }
-    error = error + E_square;
-    y= y + ystep;
-  }
+    if (t < 2) {
+        return;
+    }
+
+    /*
+     * Lines reach half a pixel past their ends, which already covers
+     * the gap of a gentle bend. half * tan(angle / 2) is at most
+     * half * cross / (2 * dot), so skip any bend where that is within
+     * half a pixel.
+     */
+    if ((dot > 0) && (half * (cross < 0 ? -cross : cross) <= dot * THICK_ONE)) {
+        return;
+    }
+
+    if (!thick_normal(x0, y0, x1, y1, half, &ax, &ay) ||
+        !thick_normal(x1, y1, x2, y2, half, &bx, &by)) {
+        return;
+    }
+
+    uint8_t amount = thick_join(
+        x1 * THICK_ONE + THICK_ONE / 2, y1 * THICK_ONE + THICK_ONE / 2,
+        ax, ay, bx, by, half, vertices
+    );
+
+    if (amount) {
+        hagl_fill_convex_subpixel(amount, vertices, color);
+    }
 }
 
+/*
+ * One side of a stroke outline. The left side is added as it is walked
+ * and the right side backwards, so the two run round the outline the
+ * same way and the edge table can take them in any order.
+ */
+typedef struct {
+    hagl_edge_table_t *table;
+    int32_t x;
+    int32_t y;
+    bool reverse;
+} thick_side_t;
+
+static void thick_side_to(thick_side_t *side, int32_t x, int32_t y) {
+    if (side->reverse) {
+        hagl_edge_table_add(side->table, x, y, side->x, side->y);
+    } else {
+        hagl_edge_table_add(side->table, side->x, side->y, x, y);
+    }
+    side->x = x;
+    side->y = y;
+}
 
-/***********************************************************************
- *                                                                     *
- *                                ENTRY                                *
- *                                                                     *
- ***********************************************************************/
+/*
+ * Carry both sides round the bend at (cx, cy) from normal a to normal
+ * b. The outside of the bend takes the join. The inside goes through
+ * the centre, where the two segments' ends meet, unless both segments
+ * are at least reach pixels long and so cover the corner it cuts off.
+ */
+static void thick_bend(thick_side_t *left, thick_side_t *right, int32_t cx, int32_t cy, int32_t ax, int32_t ay, int32_t bx, int32_t by, int32_t half, int32_t reach) {
+    int32_t join[8];
+    uint8_t amount = thick_join(cx, cy, ax, ay, bx, by, half, join);
+
+    if (amount == 0) {
+        /* Straight on, or straight back where both sides turn round. */
+        if ((int64_t)ax * bx + (int64_t)ay * by < 0) {
+            thick_side_to(left, cx + ax, cy + ay);
+            thick_side_to(left, cx, cy);
+            thick_side_to(right, cx - ax, cy - ay);
+            thick_side_to(right, cx, cy);
+        }
+        thick_side_to(left, cx + bx, cy + by);
+        thick_side_to(right, cx - bx, cy - by);
+        return;
+    }
 
-void draw_varthick_line(int16_t x0,int16_t y0,int16_t x1, int16_t y1, int16_t t, color_t color) {
+    thick_side_t *outside = left;
+    thick_side_t *inside = right;
+    int32_t sign = -1;
+    int64_t cross = (int64_t)ax * by - (int64_t)ay * bx;
 
-  if(x0 == x1 && y0 == y1) return;
+    if (cross > 0) {
+        outside = right;
+        inside = left;
+        sign = 1;
+    }
 
-  int16_t dx,dy,xstep,ystep;
-  int16_t pxstep = 0; 
-  int16_t pystep = 0;
+    for (uint8_t i = 1; i < amount; i++) {
+        thick_side_to(outside, join[i << 1], join[(i << 1) + 1]);
+    }
 
-  dx= x1-x0;
-  dy= y1-y0;
-  xstep= ystep= 1;
+    /* The corner reaches half * sin(angle) along each segment. */
+    thick_side_to(inside, cx + sign * ax, cy + sign * ay);
+    if ((cross < 0 ? -cross : cross) > (int64_t)half * THICK_ONE * reach) {
+        thick_side_to(inside, cx, cy);
+    }
+    thick_side_to(inside, cx + sign * bx, cy + sign * by);
+}
+
+void draw_thick_polyline(uint16_t amount, const int16_t *vertices, int16_t t, hagl_edge_t *edges, color_t color) {
+    hagl_edge_table_t table;
+    thick_side_t left = { &table, 0, 0, false };
+    thick_side_t right = { &table, 0, 0, true };
+    int32_t half = t * THICK_ONE - THICK_ONE / 2;
+    int32_t first_x = 0, first_y = 0;
+    int32_t last_x = 0, last_y = 0;
+    int32_t first_reach = 0, last_reach = 0;
+    bool started = false;
+
+    if ((t < 1) || (amount < 2)) {
+        return;
+    }
+
+    /* Repeats of the last point would leave the real end unextended. */
+    uint16_t last = amount - 1;
+    while ((last > 0) &&
+        (vertices[last << 1] == vertices[(last - 1) << 1]) &&
+        (vertices[(last << 1) + 1] == vertices[((last - 1) << 1) + 1])) {
+        last--;
+    }
 
-  if (dx<0) { dx= -dx; xstep= -1; }
-  if (dy<0) { dy= -dy; ystep= -1; }
+    bool closed = (last > 1) &&
+        (vertices[0] == vertices[last << 1]) &&
+        (vertices[1] == vertices[(last << 1) + 1]);
+
+    hagl_edge_table_init(&table, edges);
+
+    for (uint16_t i = 0; i < last; i++) {
+        int16_t x0 = vertices[i << 1];
+        int16_t y0 = vertices[(i << 1) + 1];
+        int16_t x1 = vertices[(i + 1) << 1];
+        int16_t y1 = vertices[((i + 1) << 1) + 1];
+        int32_t nx, ny;
+
+        if (!thick_normal(x0, y0, x1, y1, half, &nx, &ny)) {
+            continue;
+        }
+
+        /* No longer than the segment, which is all the bend needs. */
+        int32_t reach = (ABS(x1 - x0) > ABS(y1 - y0)) ? ABS(x1 - x0) : ABS(y1 - y0);
+
+        int32_t ax = x0 * THICK_ONE + THICK_ONE / 2;
+        int32_t ay = y0 * THICK_ONE + THICK_ONE / 2;
+
+        if (started) {
+            thick_bend(&left, &right, ax, ay, last_x, last_y, nx, ny, half, (reach < last_reach) ? reach : last_reach);
+        } else {
+            first_x = nx;
+            first_y = ny;
+            first_reach = reach;
+
+            /* Open ends reach half a pixel further, as draw_thick_line() does. */
+            if (!closed) {
+                ax -= ny * (THICK_ONE / 2) / half;
+                ay += nx * (THICK_ONE / 2) / half;
+            }
+
+            left.x = ax + nx;
+            left.y = ay + ny;
+            right.x = ax - nx;
+            right.y = ay - ny;
+
+            if (!closed) {
+                hagl_edge_table_add(&table, right.x, right.y, left.x, left.y);
+            }
+        }
+
+        last_x = nx;
+        last_y = ny;
+        last_reach = reach;
+        started = true;
+    }
+
+    if (!started) {
+        return;
+    }
 
-  if (dx==0) xstep= 0;
-  if (dy==0) ystep= 0;
+    int32_t bx = vertices[last << 1] * THICK_ONE + THICK_ONE / 2;
+    int32_t by = vertices[(last << 1) + 1] * THICK_ONE + THICK_ONE / 2;
 
-  switch(xstep + ystep*4)
-  {
-    case -1 + -1*4 :  pystep= -1; pxstep=  1; break;  // -5
-    case -1 +  0*4 :  pystep= -1; pxstep=  0; break;  // -1
-    case -1 +  1*4 :  pystep=  1; pxstep=  1; break;  // 3
-    case  0 + -1*4 :  pystep=  0; pxstep= -1; break;  // -4
-    case  0 +  0*4 :  pystep=  0; pxstep=  0; break;  // 0
-    case  0 +  1*4 :  pystep=  0; pxstep=  1; break;  // 4
-    case  1 + -1*4 :  pystep= -1; pxstep= -1; break;  // -3
-    case  1 +  0*4 :  pystep= -1; pxstep=  0; break;  // 1
-    case  1 +  1*4 :  pystep=  1; pxstep= -1; break;  // 5
-  }
+    if (closed) {
+        /* Joining the last segment to the first brings both sides home. */
+        thick_bend(&left, &right, bx, by, last_x, last_y, first_x, first_y, half, (first_reach < last_reach) ? first_reach : last_reach);
+    } else {
+        bx += last_y * (THICK_ONE / 2) / half;
+        by -= last_x * (THICK_ONE / 2) / half;
 
-  if (dx>dy) x_varthick_line(x0,y0,dx,dy,xstep,ystep,t,pxstep,pystep,color);
-        else y_varthick_line(x0,y0,dx,dy,xstep,ystep,t,pxstep,pystep,color);
-}
\ No newline at end of file
+        thick_side_to(&left, bx + last_x, by + last_y);
+        thick_side_to(&right, bx - last_x, by - last_y);
+        hagl_edge_table_add(&table, left.x, left.y, right.x, right.y);
+    }
+
+    hagl_edge_table_fill(&table, HAGL_FILL_NONZERO, color);
+}
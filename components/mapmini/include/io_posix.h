@@ -1,30 +1,59 @@
+#ifndef IO_GUARD
+#define IO_GUARD
+
 #include <stdint.h>
+#include <stddef.h>
 #include <stdio.h>
 
-#define FILE_READ_BUFFER_SIZE 4096  
+// Initial size of the device block cache, grown to fit the largest span up
+// to READER_BLOCK_MAX. Longer spans fail to read.
+#define READER_BLOCK_SIZE 16384
+#define READER_BLOCK_MAX 32768
+
+// Spans this short, tile index entries, are read on their own so the block
+// keeps the tiles around the last one.
+#define READER_SMALL_SPAN 16
 
-typedef struct _file_buffer_handler {
+// Whole file memory mapped on the host. On the device spans are served from
+// one block read from the SD card, so a span is only valid until the next
+// reader_span() call on the same reader.
+typedef struct _map_reader {
+    uint64_t size;
+#ifdef ESP_PLATFORM
     FILE * fp;
-    uint16_t buffer_pos;
-    uint16_t bytes_read;
-    uint8_t buffer_ptr[FILE_READ_BUFFER_SIZE];
-} fb_handler;
-
-int init_buffer(fb_handler * fbh, char * filename);
-void load_buffer(fb_handler * fbh);
-void relative_reset_buffer(fb_handler * fbh, uint16_t seek);
-uint16_t get_remaining_bytes(fb_handler * fbh);
-
-static inline void file_seek(fb_handler * fbh, uint32_t offset) { 
-    fseek(fbh->fp, offset, SEEK_SET);
-    load_buffer(fbh);
-};
-
-static inline void file_seek_rel(fb_handler * fbh, uint32_t offset) { 
-    fseek(fbh->fp, offset, SEEK_CUR);
-    load_buffer(fbh);
-};
-
-static inline void file_close(fb_handler * fbh) { 
-    fclose(fbh->fp); 
-};
\ No newline at end of file
+    uint8_t * block;
+    size_t block_cap;
+    uint64_t block_off;
+    size_t block_len;
+    uint8_t small[READER_SMALL_SPAN];
+#else
+    const uint8_t * base;
+#endif
+} map_reader_t;
+
+// Read position within a span. Reads past the end return zero and set error,
+// which then stays set, so callers only need to check once per record.
+typedef struct _cursor {
+    const uint8_t * ptr;
+    const uint8_t * end;
+    uint8_t error;
+} cursor_t;
+
+int reader_open(map_reader_t * rd, char * filename);
+void reader_close(map_reader_t * rd);
+int reader_span(map_reader_t * rd, cursor_t * c, uint64_t offset, size_t len);
+
+static inline size_t cursor_remaining(const cursor_t * c) {
+    return c->end - c->ptr;
+}
+
+static inline void cursor_skip(cursor_t * c, size_t len) {
+    if(len > cursor_remaining(c)) {
+        c->ptr = c->end;
+        c->error = 1;
+        return;
+    }
+    c->ptr += len;
+}
+
+#endif
@@ -1,6 +1,17 @@
+#ifndef MAP_GUARD
+#define MAP_GUARD
+
 #include <stdio.h>
 #include <stdint.h>
 #include "way.h"
+#include "io_posix.h"
+#include "proj.h"
+#include "tags.h"
+#include "style.h"
+
+#define MAP_MAX_ZOOM_INTERVALS 3
+#define MAP_MAX_LABELS 32
+#define MAP_AREA_MAX_EDGES 1024 // Scratch for filling one area
 
 typedef struct _mapsforge_zoom_interval {
     uint8_t base_zoom;
@@ -10,6 +21,8 @@ typedef struct _mapsforge_zoom_interval {
     uint64_t sub_file_size;
     uint16_t n_tiles_x;
     uint16_t n_tiles_y;
+    uint32_t tile_x0; // Base zoom tile at the top left of the bounding box
+    uint32_t tile_y0;
 } mapsforge_zoom_interval;
 
 typedef struct _mapsforge_file_header {
@@ -26,17 +39,78 @@ typedef struct _mapsforge_file_header {
     char lang_pref[32];
     char comment[40];
     char created_by[40];
-    uint16_t n_poi_tags;
-    char poi_tag_names[100][32];
-    uint16_t n_way_tags;
-    char way_tag_names[360][32];
+    tag_table_t poi_tags;
+    tag_table_t way_tags;
     uint8_t n_zoom_intervals;
-    mapsforge_zoom_interval zoom_conf[3];
+    mapsforge_zoom_interval zoom_conf[MAP_MAX_ZOOM_INTERVALS];
 } mapsforge_file_header;
 
-void g_draw_way(way_prop * way, uint8_t colour, uint8_t layer, int16_t xo, int16_t yo, float rot, uint16_t size);
-int load_map(arena_t* a0, char* filename, way_prop** way_list_ptr, uint32_t x_in, uint32_t y_in, uint32_t z_in, int16_t x0, int16_t y0, uint16_t st, float rot, float size);
+// Tiles map_load_tile() addresses at a zoom. Up to the interval's base zoom
+// these are base zoom tiles decoded with that zoom's detail, past it they
+// are the zoom's own tiles cut out of the base tile by subtile (over-zoom).
+typedef struct _map_tile_grid {
+    uint8_t z;
+    uint8_t base_zoom;
+    uint32_t x0; // Top left tile in the file's bounding box
+    uint32_t y0;
+    uint32_t n_x;
+    uint32_t n_y;
+} map_tile_grid_t;
+
+// Open map file, header is parsed once and the file kept open for tile loads.
+typedef struct _map_handle {
+    map_reader_t rd;
+    mapsforge_file_header hdr;
+    const way_filter_t * filter; // NULL decodes every way
+    uint8_t pois; // Decode POIs too, otherwise their block is jumped over
+    uint8_t simplify; // Pixels ways are thinned to as they're decoded, 0 keeps every node
+    style_table_t style;
+    style_table_t poi_style;
+} map_handle_t;
+
+// Turn of the map about the screen centre for one frame, in fixed point
+// with MAP_VIEW_BITS fraction bits, and where the tile being drawn sits.
+// The screen is whatever is drawn into, the display or a larger texture.
+// The turn is worked out once per frame by map_view_init(), then each tile
+// sets its offset and goes through map_view_transform() before drawing.
+#define MAP_VIEW_BITS 14
+
+typedef struct _map_view {
+    int32_t cos_r;
+    int32_t sin_r;
+    uint16_t w; // Screen size
+    uint16_t h;
+    int16_t xo; // Screen position of the tile's top left corner, north up
+    int16_t yo;
+} map_view_t;
+
+// Screen boxes of the labels drawn so far this frame, later labels that
+// would overlap one are dropped.
+typedef struct _label_set {
+    uint8_t n;
+    int16_t box[MAP_MAX_LABELS][4]; // x0, y0, x1, y1
+} label_set_t;
+
+void map_view_init(map_view_t * v, float rot, uint16_t w, uint16_t h);
+int map_view_transform(const map_view_t * v, const map_tile_t * tile, int16_t margin);
+int map_view_box_visible(const map_view_t * v, const way_box * b, int16_t margin);
+void g_draw_way(const map_tile_t * tile, uint16_t w, color_t cl, uint8_t th, const map_view_t * v);
+int g_fill_area(const map_tile_t * tile, uint16_t w, color_t cl, const map_view_t * v);
+void g_draw_layer(const map_tile_t * tile, const style_table_t * stt, uint8_t layer, uint8_t casing, uint8_t zoom, const map_view_t * v);
+void g_draw_pois(const map_tile_t * tile, const style_table_t * stt, uint8_t zoom, const map_view_t * v);
+void g_draw_poi_labels(const map_tile_t * tile, const style_table_t * stt, uint8_t zoom, const map_view_t * v, label_set_t * ls);
+int open_map(map_handle_t * mh, char * filename);
+void close_map(map_handle_t * mh);
+int map_set_theme(map_handle_t * mh, const theme_t * theme);
+int map_tile_grid(const mapsforge_file_header * hdr, uint8_t zoom, map_tile_grid_t * g);
+void map_tile_fit(uint32_t x_in, uint32_t y_in, uint32_t z_in, float size, float * scale, float * x_scale);
+int map_filter_init(way_filter_t * wf, const tag_table_t * tags, const char * const * names, int n_names);
+void map_filter_free(way_filter_t * wf);
+int map_load_tile(map_handle_t * mh, arena_t * a0, map_tile_t * tile, uint32_t x_in, uint32_t y_in, uint32_t z_in, uint16_t st, float size);
+int load_map(arena_t* a0, char* filename, map_tile_t * tile, uint32_t x_in, uint32_t y_in, uint32_t z_in, int16_t x0, int16_t y0, uint16_t st, float rot, float size);
 int long2tilex(double lon, int z);
 int lat2tiley(double lat, int z);
 float tilex2long(int x, int z);
-float tiley2lat(int y, int z);
\ No newline at end of file
+float tiley2lat(int y, int z);
+
+#endif
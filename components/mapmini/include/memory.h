@@ -12,8 +12,11 @@ typedef struct {
     size_t current;
 } arena_t;
 
-void  arena_init(arena_t * arena, size_t size);
+void  arena_init_buffer(arena_t * arena, uint8_t * buffer, size_t size);
 void* arena_malloc(arena_t * arena, size_t size);
+void  arena_align(arena_t * arena, size_t align);
 size_t arena_free(arena_t * arena);
+size_t arena_left(arena_t * arena);
+void  arena_shrink(arena_t * arena, size_t size);
 
 #endif
@@ -7,20 +7,33 @@
 #include <string.h>
 #include "io_posix.h"
 
-uint8_t get_uint8(fb_handler * fbh);
-uint16_t get_uint16(fb_handler * fbh);
-uint32_t get_uint32(fb_handler * fbh);
-uint64_t get_uint64(fb_handler * fbh);
+#define VBE_INT_MAX_BYTES 5
+#define VBE_RUN_SLACK 8 // Bytes that must remain for an unchecked decode
 
-int_least8_t get_int8(fb_handler * fbh);
-int16_t get_int16(fb_handler * fbh);
-int32_t get_int32(fb_handler * fbh);
-int64_t get_int64(fb_handler * fbh);
+static inline uint8_t get_uint8(cursor_t * c) {
+    if(c->ptr == c->end) {
+        c->error = 1;
+        return 0;
+    }
 
-uint64_t get_varint(fb_handler * fbh, uint8_t len);
-uint32_t get_vbe_uint(fb_handler * fbh);
-int32_t get_vbe_int(fb_handler * fbh);
+    return *c->ptr++;
+}
 
-void get_string(fb_handler * fbh, char * ptr, uint8_t len);
+uint16_t get_uint16(cursor_t * c);
+uint32_t get_uint32(cursor_t * c);
+uint64_t get_uint64(cursor_t * c);
+
+int_least8_t get_int8(cursor_t * c);
+int16_t get_int16(cursor_t * c);
+int32_t get_int32(cursor_t * c);
+int64_t get_int64(cursor_t * c);
+
+uint64_t get_varint(cursor_t * c, uint8_t len);
+uint32_t get_vbe_uint(cursor_t * c);
+int32_t get_vbe_int(cursor_t * c);
+size_t decode_vbe_int_run(cursor_t * c, int32_t * out, size_t n);
+void skip_vbe_run(cursor_t * c, size_t n);
+
+void get_string(cursor_t * c, char * ptr, uint8_t len);
 
 #endif
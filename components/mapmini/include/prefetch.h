@@ -0,0 +1,82 @@
+#ifndef PREFETCH_GUARD
+#define PREFETCH_GUARD
+
+#include <stdint.h>
+#include "map.h"
+#include "memory.h"
+#include "spsc.h"
+#include "tile_cache.h"
+#include "viewport.h"
+
+#ifdef ESP_PLATFORM
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#else
+#include <pthread.h>
+#include <semaphore.h>
+#endif
+
+#define PREFETCH_BUFFERS 2
+#define PREFETCH_QUEUE_LEN 8 // Power of two
+
+typedef struct _prefetch_req {
+    uint32_t    x;
+    uint32_t    y;
+    uint8_t     z;
+    uint16_t    st;
+    float       size;
+} prefetch_req_t;
+
+typedef struct _prefetch_buf {
+    prefetch_req_t req;
+    arena_t     arena;
+    map_tile_t  tile;
+    int         status; // Way count, negative if the load failed
+} prefetch_buf_t;
+
+// Decodes tiles next to the viewport on a worker task, with its own map
+// handle, into spare arenas lent by the tile cache that the renderer swaps
+// into it. requests and free_bufs flow renderer -> worker, done flows back.
+typedef struct _prefetcher {
+    map_handle_t    mh;
+    tile_cache_t  * cache; // Lent the buffers' arenas
+    prefetch_buf_t  buf[PREFETCH_BUFFERS];
+
+    spsc_queue_t    requests;
+    spsc_queue_t    done;
+    spsc_queue_t    free_bufs;
+    prefetch_req_t  request_storage[PREFETCH_QUEUE_LEN];
+    prefetch_buf_t* done_storage[PREFETCH_QUEUE_LEN];
+    prefetch_buf_t* free_storage[PREFETCH_QUEUE_LEN];
+
+    // Renderer side bookkeeping of tiles requested but not yet adopted.
+    prefetch_req_t  pending[PREFETCH_QUEUE_LEN];
+    uint8_t         n_pending;
+
+    volatile uint8_t running;
+    uint32_t        adopted;
+#ifdef ESP_PLATFORM
+    TaskHandle_t    task;
+    volatile uint8_t stopped;
+#else
+    pthread_t       thread;
+    sem_t           wake;
+#endif
+} prefetcher_t;
+
+// tc is the cache results are adopted into, set up with PREFETCH_BUFFERS
+// spare arenas, and theme the one set on the renderer's handle (NULL for
+// the built in rules). Adopting swaps arenas between the buffers and the
+// cache's slots, so stop hands whichever the buffers hold back to tc.
+// Stop before tile_cache_free().
+int prefetch_start(prefetcher_t * pf, char * filename, tile_cache_t * tc, const theme_t * theme);
+void prefetch_stop(prefetcher_t * pf);
+
+// Queue the tiles around the current viewport, nearest to heading first.
+// Heading is in radians clockwise from north.
+void prefetch_update(prefetcher_t * pf, tile_cache_t * tc, viewport_t * vp, float heading);
+
+// Move finished tiles into the cache, call from the render task.
+int prefetch_poll(prefetcher_t * pf, tile_cache_t * tc);
+
+#endif
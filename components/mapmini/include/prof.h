@@ -0,0 +1,58 @@
+#ifndef PROF_GUARD
+#define PROF_GUARD
+
+#include <stdint.h>
+
+// Per-stage timing hooks, compiled out unless MAPMINI_PROFILE is defined.
+typedef enum {
+    PROF_HEADER,
+    PROF_LOOKUP,
+    PROF_DECODE,
+    PROF_RASTER,
+    PROF_N_STAGES
+} prof_stage;
+
+typedef struct {
+    uint64_t total_us;
+    uint32_t calls;
+} prof_counter;
+
+// Event counts kept alongside the stage timers.
+typedef enum {
+    PROF_WAYS_DRAWN,
+    PROF_WAYS_CULLED,
+    PROF_TILES_CULLED,
+    PROF_N_COUNTS
+} prof_count;
+
+#ifdef MAPMINI_PROFILE
+
+// Per thread on the host so a prefetch worker doesn't skew the render task.
+#ifdef ESP_PLATFORM
+#define PROF_TLS
+#else
+#define PROF_TLS __thread
+#endif
+
+extern PROF_TLS prof_counter prof_counters[PROF_N_STAGES];
+extern PROF_TLS uint32_t prof_counts[PROF_N_COUNTS];
+
+uint64_t prof_time_us(void);
+void prof_reset(void);
+
+#define PROF_START(S) uint64_t _prof_start_##S = prof_time_us()
+#define PROF_END(S) do { \
+        prof_counters[S].total_us += prof_time_us() - _prof_start_##S; \
+        prof_counters[S].calls++; \
+    } while(0)
+#define PROF_COUNT(C) (prof_counts[C]++)
+
+#else
+
+#define PROF_START(S)
+#define PROF_END(S)
+#define PROF_COUNT(C)
+
+#endif
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef PROJ_GUARD
+#define PROJ_GUARD
+
+#include <stdint.h>
+
+#define PROJ_LUT_SEGMENTS 16
+
+// Per tile projection from microdegree offsets to pixels, one 32x32->64 bit
+// multiply and shift per axis per node. Factors are normalised so the
+// multiplier keeps 30 significant bits at any zoom or tile size.
+typedef struct _proj {
+    int32_t x_mul;
+    int32_t y_mul;
+    uint8_t x_shift;
+    uint8_t y_shift;
+
+    // Microdegrees from the tile origin way nodes are stored against to the
+    // origin being drawn, non-zero when over-zooming into part of a tile.
+    int32_t lat_off;
+    int32_t lon_off;
+
+    // Web-Mercator latitude, piecewise linear over the tile height.
+    uint8_t seg_shift;
+    int32_t seg_mul;
+    int32_t lut[PROJ_LUT_SEGMENTS+1]; // Pixels at each segment boundary, Q8
+} proj_t;
+
+void proj_init(proj_t * pj, float scale, float x_scale);
+void proj_init_mercator(proj_t * pj, double lat0, double lat1, float size);
+
+// Rounds towards zero like the float conversion it replaces.
+static inline int32_t proj_mul(int32_t v, int32_t mul, uint8_t shift) {
+    int64_t p = (int64_t)v * mul;
+    if(p < 0) p += ((int64_t)1 << shift) - 1;
+    return (int32_t)(p >> shift);
+}
+
+static inline int32_t proj_lon(const proj_t * pj, int32_t lon) {
+    return proj_mul(lon, pj->x_mul, pj->x_shift);
+}
+
+static inline int32_t proj_lat(const proj_t * pj, int32_t lat) {
+    return proj_mul(lat, pj->y_mul, pj->y_shift);
+}
+
+static inline int32_t proj_lat_mercator(const proj_t * pj, int32_t lat) {
+    // Segment position in Q16, nodes off the tile extrapolate the end segments
+    int64_t t = ((int64_t)-lat * pj->seg_mul) >> pj->seg_shift;
+    int32_t i = t >> 16;
+
+    if(i < 0) i = 0;
+    if(i > PROJ_LUT_SEGMENTS-1) i = PROJ_LUT_SEGMENTS-1;
+
+    int64_t frac = t - ((int64_t)i << 16);
+    int64_t y = pj->lut[i] + (((pj->lut[i+1] - pj->lut[i]) * frac) >> 16);
+
+    return (int32_t)((y < 0 ? y + 255 : y) >> 8);
+}
+
+#ifdef MAPMINI_MERCATOR
+#define PROJ_LAT(PJ, LAT) proj_lat_mercator(PJ, LAT)
+#else
+#define PROJ_LAT(PJ, LAT) proj_lat(PJ, LAT)
+#endif
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef SPSC_GUARD
+#define SPSC_GUARD
+
+#include <stdint.h>
+#include <string.h>
+
+// Lock-free single producer/single consumer ring of fixed size elements.
+// Capacity must be a power of two; head is only written by the producer
+// and tail only by the consumer.
+typedef struct _spsc_queue {
+    uint8_t * storage;
+    uint16_t elem_size;
+    uint32_t mask;
+    uint32_t head;
+    uint32_t tail;
+} spsc_queue_t;
+
+static inline void spsc_init(spsc_queue_t * q, void * storage, uint16_t elem_size, uint32_t capacity) {
+    q->storage = storage;
+    q->elem_size = elem_size;
+    q->mask = capacity - 1;
+    q->head = 0;
+    q->tail = 0;
+}
+
+static inline int spsc_push(spsc_queue_t * q, const void * elem) {
+    uint32_t head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    uint32_t tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+
+    if(head - tail > q->mask) return 0; // Full
+
+    memcpy(q->storage + (head & q->mask)*q->elem_size, elem, q->elem_size);
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+
+    return 1;
+}
+
+static inline int spsc_pop(spsc_queue_t * q, void * elem) {
+    uint32_t tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    uint32_t head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+
+    if(head == tail) return 0; // Empty
+
+    memcpy(elem, q->storage + (tail & q->mask)*q->elem_size, q->elem_size);
+    __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+
+    return 1;
+}
+
+#endif
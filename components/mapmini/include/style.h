@@ -0,0 +1,68 @@
+#ifndef STYLE_GUARD
+#define STYLE_GUARD
+
+#include <stdint.h>
+#include "hagl_hal.h"
+#include "tags.h"
+
+#define STYLE_MAX 64
+#define STYLE_NONE 0
+#define STYLE_MAX_PRIORITY 15
+
+#define THEME_MAX_RULES 128
+
+typedef struct _way_style {
+    color_t colour;
+    color_t casing; // Drawn width+2 under the fill, 0 for none
+    uint8_t width;
+    uint8_t min_zoom; // Inclusive zoom range the style is drawn at
+    uint8_t max_zoom;
+    uint8_t priority; // Draw order within a layer, higher on top
+} way_style_t;
+
+// Matched against the file's tag names when the table is built.
+typedef struct _style_rule {
+    const char * tag; // key=value
+    uint32_t colour; // 0xRRGGBB
+    uint32_t casing;
+    uint8_t width;
+    uint8_t min_zoom;
+    uint8_t max_zoom;
+    uint8_t priority;
+} style_rule_t;
+
+// Rules read from a theme file, tags point into the file text.
+typedef struct _theme {
+    int n_rules;
+    style_rule_t * rules;
+    char * text;
+} theme_t;
+
+// Way tag id to style index, compiled once per map file so decoding a way
+// is a table lookup per tag. Style 0 is unstyled and never drawn.
+typedef struct _style_table {
+    uint16_t n_tags;
+    uint8_t * tag_style;
+    uint8_t n_styles;
+    uint8_t max_width; // Widest line any style draws, casing included
+    way_style_t style[STYLE_MAX];
+} style_table_t;
+
+extern const style_rule_t style_default_rules[];
+extern const int style_default_n_rules;
+
+int theme_load(theme_t * th, const char * filename);
+void theme_free(theme_t * th);
+
+int style_table_init(style_table_t * stt, const tag_table_t * tags, const style_rule_t * rules, int n_rules);
+void style_table_free(style_table_t * stt);
+
+static inline uint8_t style_lookup(const style_table_t * stt, uint32_t id) {
+    return (id < stt->n_tags) ? stt->tag_style[id] : STYLE_NONE;
+}
+
+static inline int style_visible(const way_style_t * s, uint8_t zoom) {
+    return zoom >= s->min_zoom && zoom <= s->max_zoom;
+}
+
+#endif
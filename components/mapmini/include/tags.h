@@ -0,0 +1,17 @@
+#ifndef TAGS_GUARD
+#define TAGS_GUARD
+
+#include <stdint.h>
+
+// Tag names packed back to back in a single pool, indexed by tag id.
+typedef struct _tag_table {
+    uint16_t n_tags;
+    uint16_t * offset;
+    char * pool;
+} tag_table_t;
+
+static inline const char * tag_name(const tag_table_t * tt, uint32_t id) {
+    return (id < tt->n_tags) ? tt->pool + tt->offset[id] : NULL;
+}
+
+#endif
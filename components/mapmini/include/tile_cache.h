@@ -0,0 +1,67 @@
+#ifndef TILE_CACHE_GUARD
+#define TILE_CACHE_GUARD
+
+#include <stdint.h>
+#include "map.h"
+#include "memory.h"
+
+#define TILE_CACHE_MAX_SLOTS 16
+#define TILE_CACHE_MAX_SPARE 4
+
+typedef struct _tile_cache_entry {
+    uint8_t     valid;
+    uint8_t     z;
+    uint32_t    x;
+    uint32_t    y;
+    uint16_t    st;
+    float       size;
+    uint32_t    last_used;
+    arena_t     arena;
+    map_tile_t  tile;
+} tile_cache_entry_t;
+
+// Decoded tiles for the N most recently used (zoom, x, y), each slot owns
+// a fixed size arena carved out of one allocation made at init. Spare
+// arenas of the same size come from it too, for decoding tiles elsewhere
+// that tile_cache_adopt() then swaps in, so every arena the cache ever
+// holds is inside its own region.
+typedef struct _tile_cache {
+    tile_cache_entry_t entry[TILE_CACHE_MAX_SLOTS];
+    uint8_t     n_slots;
+    arena_t     spare[TILE_CACHE_MAX_SPARE]; // Not lent out at the moment
+    uint8_t     n_spare;
+    uint8_t   * region;
+    size_t      slot_size;
+    uint32_t    tick;
+    uint32_t    frame_tick;
+    uint32_t    hits;
+    uint32_t    misses;
+} tile_cache_t;
+
+int tile_cache_init(tile_cache_t * tc, uint8_t n_slots, uint8_t n_spare, size_t slot_size);
+void tile_cache_free(tile_cache_t * tc);
+
+// Lend out a spare arena, returns 1 if there are none left. Whatever
+// arena the borrower holds at the end, after adopting tiles swapped it,
+// goes back with tile_cache_give_back() before tile_cache_free().
+int tile_cache_lend(tile_cache_t * tc, arena_t * arena);
+void tile_cache_give_back(tile_cache_t * tc, const arena_t * arena);
+void tile_cache_flush(tile_cache_t * tc);
+
+// Returns the way count of the tile and sets *tile, decoding it on a miss.
+// The tile stays valid until its slot is evicted by a later miss.
+int tile_cache_get(tile_cache_t * tc, map_handle_t * mh, const map_tile_t ** tile, uint32_t x, uint32_t y, uint32_t z, uint16_t st, float size);
+
+// Entries used after this call are protected from tile_cache_adopt().
+void tile_cache_begin_frame(tile_cache_t * tc);
+
+// Peek without touching the LRU order or the hit/miss counters.
+int tile_cache_contains(tile_cache_t * tc, uint32_t x, uint32_t y, uint32_t z, uint16_t st, float size);
+
+// Insert a tile decoded elsewhere into an arena lent by the cache.
+// The arena is swapped with the evicted slot's, so on return *arena holds
+// the (emptied) evicted region. Returns 1 if the tile was already cached,
+// -1 if there is no slot to spare; the arena is left untouched in both.
+int tile_cache_adopt(tile_cache_t * tc, arena_t * arena, const map_tile_t * tile, uint32_t x, uint32_t y, uint32_t z, uint16_t st, float size);
+
+#endif
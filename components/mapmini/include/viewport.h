@@ -0,0 +1,38 @@
+#ifndef VIEWPORT_GUARD
+#define VIEWPORT_GUARD
+
+#include <stdint.h>
+#include "map.h"
+#include "tile_cache.h"
+
+#define VIEWPORT_MAX_TILES 16
+
+typedef struct _viewport_tile {
+    uint32_t    x;
+    uint32_t    y;
+    int16_t     xo; // Screen position of the tile's top left corner, north up
+    int16_t     yo;
+    const map_tile_t * tile;
+} viewport_tile_t;
+
+// Tiles covering a (rotated) screen centred on a lat/lon.
+typedef struct _viewport {
+    int32_t     lat; // Microdegrees
+    int32_t     lon;
+    uint8_t     zoom;
+    uint8_t     tile_zoom; // Zoom of the tile grid, see map_tile_grid_t
+    uint16_t    width;
+    uint16_t    height;
+    float       rot;
+    float       tile_px; // On screen size of one tile
+    const style_table_t * style;
+    const style_table_t * poi_style;
+    uint8_t     n_tiles;
+    viewport_tile_t tile[VIEWPORT_MAX_TILES];
+} viewport_t;
+
+int viewport_load(viewport_t * vp, tile_cache_t * tc, map_handle_t * mh, int32_t lat, int32_t lon, uint8_t zoom, uint16_t width, uint16_t height, float rot, float size);
+void viewport_draw(viewport_t * vp);
+void viewport_offset(const viewport_t * vp, int32_t lat, int32_t lon, float * dx, float * dy);
+
+#endif
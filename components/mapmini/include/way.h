@@ -5,37 +5,155 @@
 #include <math.h>
 #include "parse.h"
 #include "memory.h"
+#include "proj.h"
+#include "style.h"
+
+#define TILE_LAYERS 16 // osm_layer is stored as layer+5 in 4 bits
+#define TILE_GRID 8 // Cells across and down the grid index of a tile
 
 typedef struct _way_coord {
     int16_t x;
     int16_t y;
 } way_coord;
 
-typedef struct _way_coord_blk { 
-    uint16_t nodes;
-    way_coord * coords; 
-} way_coord_blk;
-
-typedef struct _way_data {
-    uint8_t polygons;
-    way_coord_blk * block;
-} way_data;
-
-typedef struct _way_prop {
-    uint16_t    subtile_bitmap;
-    uint8_t     osm_layer;
-    uint8_t     n_tags;
-    uint8_t *  tag_ids;
-    uint8_t     flags;
-    char *      name;
-    char *      reference;
-    char *      house;
-    way_coord   label_off;
-    uint8_t     blocks;
-    way_data  * data;
-} way_prop;
-
-uint32_t get_way(way_prop * wp, fb_handler * fbh, arena_t * arena, uint16_t st, float scale, float x_mercator);
+// Extent of some nodes in tile pixels, inclusive. Empty when x0 > x1.
+typedef struct _way_box {
+    int16_t x0;
+    int16_t y0;
+    int16_t x1;
+    int16_t y1;
+} way_box;
+
+// Decoded tile as flat parallel arrays carved from one arena, walked by
+// index rather than by pointer. Way w owns blocks way_block[w] up to
+// way_block[w+1], block b owns polygons block_poly[b] up to block_poly[b+1]
+// (the first is the outer ring) and polygon p owns coords poly_coord[p] up
+// to poly_coord[p+1]. Tags are ranged the same way through tag_start.
+// draw_order lists the styled ways bottom to top, sorted by layer then
+// style priority, with layer l at draw_order[layer_start[l]] up to
+// draw_order[layer_start[l+1]].
+//
+// POIs, when decoded, follow the same layout with their own tags and
+// strings. Positions are tile pixels like way nodes.
+//
+// block_box bounds the nodes of every ring of block b and box every block
+// of the tile, so whole ways and tiles can be skipped off screen.
+//
+// The grid splits box into TILE_GRID x TILE_GRID square cells of
+// 1 << grid_shift pixels. Cell (cx, cy) lists the ways whose blocks reach
+// it at grid_ways[grid_start[cy*TILE_GRID+cx]] up to the next cell's start.
+// grid_mark has a bit per way, set by map_view_transform() for ways in
+// cells on screen this frame. The grid arrays are NULL if it didn't fit.
+//
+// screen and poi_screen hold coords and poi_coord moved onto the screen
+// by map_view_transform(), redone every frame the tile is drawn. They take
+// whatever room the arena has left after decoding and are NULL without it.
+typedef struct _map_tile {
+    uint16_t    n_ways;
+    uint16_t    n_blocks;
+    uint16_t    n_polys;
+    uint32_t    n_coords;
+    uint16_t    n_pois;
+
+    uint32_t  * poly_coord;
+    way_coord * coords;
+    way_coord * screen;
+    way_coord * label_off;
+    way_box   * block_box;
+    uint32_t  * grid_start;
+    uint16_t  * grid_ways;
+    uint8_t   * grid_mark;
+    uint16_t  * way_block;
+    uint16_t  * block_poly;
+    uint16_t  * tag_start;
+    uint16_t  * tags;
+    uint16_t  * draw_order;
+    uint16_t  * subtile_bitmap;
+    uint16_t  * name;       // Offsets into strings, 0 when absent
+    uint16_t  * house;
+    uint16_t  * reference;
+    uint8_t   * osm_layer;
+    uint8_t   * flags;
+    uint8_t   * style;      // Index into the decoding handle's style table
+    char      * strings;
+
+    way_coord * poi_coord;
+    way_coord * poi_screen;
+    uint16_t  * poi_tag_start;
+    uint16_t  * poi_tags;
+    uint16_t  * poi_name;   // Offsets into poi_strings, 0 when absent
+    uint8_t   * poi_layer;
+    uint8_t   * poi_style;  // Index into the decoding handle's POI style table
+    char      * poi_strings;
+
+    way_box     box;
+    uint8_t     grid_shift;
+    uint16_t    layer_start[TILE_LAYERS+1];
+} map_tile_t;
+
+// Coordinate range of the outer ring of way w's first block, empty if none.
+static inline uint32_t tile_way_coords(const map_tile_t * t, uint16_t w, uint32_t * end) {
+    uint16_t b = t->way_block[w];
+    if(b == t->way_block[w+1] || t->block_poly[b] == t->block_poly[b+1]) {
+        *end = 0;
+        return 0;
+    }
+
+    uint16_t p = t->block_poly[b];
+    *end = t->poly_coord[p+1];
+    return t->poly_coord[p];
+}
+
+// Whether the outer ring of way w's first block ends where it starts.
+static inline int tile_way_closed(const map_tile_t * t, uint16_t w) {
+    uint32_t end;
+    uint32_t c0 = tile_way_coords(t, w, &end);
+    if(end - c0 < 3) return 0;
+    return t->coords[c0].x == t->coords[end-1].x && t->coords[c0].y == t->coords[end-1].y;
+}
+
+// Extent of every block of way w, empty if it has no nodes.
+static inline way_box tile_way_box(const map_tile_t * t, uint16_t w) {
+    way_box b = { INT16_MAX, INT16_MAX, INT16_MIN, INT16_MIN };
+
+    for(uint16_t k = t->way_block[w]; k < t->way_block[w+1]; k++) {
+        const way_box * bb = &t->block_box[k];
+        if(bb->x0 < b.x0) b.x0 = bb->x0;
+        if(bb->y0 < b.y0) b.y0 = bb->y0;
+        if(bb->x1 > b.x1) b.x1 = bb->x1;
+        if(bb->y1 > b.y1) b.y1 = bb->y1;
+    }
+
+    return b;
+}
+
+// Grid cell holding tile pixel v along one axis from origin o, clamped.
+static inline int tile_grid_cell(const map_tile_t * t, int16_t v, int16_t o) {
+    int32_t c = ((int32_t)v-o) >> t->grid_shift;
+    if(c < 0) return 0;
+    if(c >= TILE_GRID) return TILE_GRID-1;
+    return c;
+}
+
+// Which ways get decoded. Shared read-only between map handles, rejected ways
+// are skipped using their size prefix without touching the arena.
+typedef struct _way_filter {
+    uint8_t min_layer;
+    uint8_t max_layer;
+    uint16_t n_tags;
+    uint8_t * tag_mask; // One bit per way tag id, NULL keeps every tag
+} way_filter_t;
+
+static inline int way_filter_tag(const way_filter_t * wf, uint32_t id) {
+    return id < wf->n_tags && (wf->tag_mask[id >> 3] & (1 << (id & 7)));
+}
+
+int decode_ways(map_tile_t * t, cursor_t * c, arena_t * arena, uint16_t n_ways, uint16_t st, const way_filter_t * wf, const style_table_t * stt, const proj_t * pj, uint8_t tol);
+uint16_t tile_grid_query(const map_tile_t * t, const way_box * b, uint16_t * out, uint16_t max);
+int decode_pois(map_tile_t * t, cursor_t * c, arena_t * arena, uint16_t n_pois, float size, const style_table_t * stt, const proj_t * pj);
+
+#define WAY_RUN_NODES 32 // Coordinate deltas decoded per batch
+#define WAY_SIMPLIFY_DEPTH 32 // Douglas-Peucker splits waiting at once
 
 #define EARTH_R_M 6378137
 #define SCALE 6
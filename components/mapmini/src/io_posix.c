@@ -1,35 +1,146 @@
 #include "io_posix.h"
+#include <stdlib.h>
 #include <esp_log.h>
 
+#ifndef ESP_PLATFORM
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 static const char *TAG = "io";
 
-int init_buffer(fb_handler * fbh, char * filename) {
-    fbh->buffer_pos = 0;
-    fbh->bytes_read = 0;
+#ifdef ESP_PLATFORM
+
+int reader_open(map_reader_t * rd, char * filename) {
+    rd->block = NULL;
+    rd->block_cap = 0;
+    rd->block_off = 0;
+    rd->block_len = 0;
 
-    fbh->fp = fopen(filename, "rb");
-    if(fbh->fp == NULL) {
+    rd->fp = fopen(filename, "rb");
+    if(rd->fp == NULL) {
         ESP_LOGI(TAG, "Couldn't open %s", filename);
+        return 1;
+    }
+
+    fseek(rd->fp, 0, SEEK_END);
+    rd->size = ftell(rd->fp);
 
+    rd->block = malloc(READER_BLOCK_SIZE);
+    if(rd->block == NULL) {
+        fclose(rd->fp);
         return 1;
     }
+    rd->block_cap = READER_BLOCK_SIZE;
+
+    return 0;
+}
+
+void reader_close(map_reader_t * rd) {
+    free(rd->block);
+    rd->block = NULL;
+    fclose(rd->fp);
+}
+
+int reader_span(map_reader_t * rd, cursor_t * c, uint64_t offset, size_t len) {
+    c->ptr = c->end = NULL;
+    c->error = 1;
+
+    if(offset > rd->size) return 1;
+    if(len > rd->size - offset) len = rd->size - offset;
+
+    // Serve from the current block when it covers the span, neighbouring
+    // tiles and index entries usually land in the same block.
+    if(offset < rd->block_off || offset + len > rd->block_off + rd->block_len) {
+        if(len <= READER_SMALL_SPAN) {
+            fseek(rd->fp, offset, SEEK_SET);
+            if(fread(rd->small, 1, len, rd->fp) < len) return 1;
+
+            c->ptr = rd->small;
+            c->end = c->ptr + len;
+            c->error = 0;
+            return 0;
+        }
+
+        if(len > rd->block_cap) {
+            if(len > READER_BLOCK_MAX) {
+                ESP_LOGE(TAG, "Span of %d bytes is over the %d byte limit", len, READER_BLOCK_MAX);
+                return 1;
+            }
+            uint8_t * block = realloc(rd->block, len);
+            if(block == NULL) {
+                ESP_LOGE(TAG, "Failed to grow block to %d", len);
+                return 1;
+            }
+            rd->block = block;
+            rd->block_cap = len;
+        }
+
+        size_t want = rd->block_cap;
+        if(want > rd->size - offset) want = rd->size - offset;
+
+        fseek(rd->fp, offset, SEEK_SET);
+        rd->block_off = offset;
+        rd->block_len = fread(rd->block, 1, want, rd->fp);
+
+        if(rd->block_len < len) return 1;
+    }
 
-    load_buffer(fbh); 
+    c->ptr = rd->block + (offset - rd->block_off);
+    c->end = c->ptr + len;
+    c->error = 0;
 
     return 0;
 }
 
-void load_buffer(fb_handler * fbh) {
-    fbh->buffer_pos = 0; // Reset buffer offset
-    fbh->bytes_read = fread(fbh->buffer_ptr, 1, FILE_READ_BUFFER_SIZE, fbh->fp);
+#else
+
+int reader_open(map_reader_t * rd, char * filename) {
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0) {
+        ESP_LOGI(TAG, "Couldn't open %s", filename);
+        return 1;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) || st.st_size == 0) {
+        close(fd);
+        return 1;
+    }
+
+    void * base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if(base == MAP_FAILED) {
+        ESP_LOGE(TAG, "Couldn't map %s", filename);
+        return 1;
+    }
+
+    rd->base = base;
+    rd->size = st.st_size;
+
+    return 0;
+}
+
+void reader_close(map_reader_t * rd) {
+    munmap((void *)rd->base, rd->size);
+    rd->base = NULL;
 }
 
-uint16_t get_remaining_bytes(fb_handler * fbh) {
-    return (fbh->bytes_read - fbh->buffer_pos);
+int reader_span(map_reader_t * rd, cursor_t * c, uint64_t offset, size_t len) {
+    c->ptr = c->end = NULL;
+    c->error = 1;
+
+    if(offset > rd->size) return 1;
+    if(len > rd->size - offset) len = rd->size - offset;
+
+    c->ptr = rd->base + offset;
+    c->end = c->ptr + len;
+    c->error = 0;
+
+    return 0;
 }
 
-void relative_reset_buffer(fb_handler * fbh, uint16_t seek) {
-    fbh->buffer_pos = 0;
-    fseek(fbh->fp, -seek, SEEK_CUR);
-    load_buffer(fbh);
-}
\ No newline at end of file
+#endif
@@ -1,10 +1,12 @@
 #include <string.h>
+#include <stdlib.h>
 #include <math.h>
 
 #include "map.h"
 #include "parse.h"
 #include "way.h"
 #include "memory.h"
+#include "prof.h"
 #include <unistd.h>
 
 #include "hagl.h"
@@ -12,6 +14,8 @@
 #include "thick.h"
 #include "rgb332.h"
 #include "aa.h"
+#include "fontx.h"
+#include "font5x7.h"
 
 #include <esp_log.h>
 
@@ -39,307 +43,694 @@ float tiley2lat(int y, int z)
 	return 180.0 / M_PI * atan(0.5 * (exp(n) - exp(-n)));
 }
 
-void g_draw_way(way_prop * way, color_t colour, uint8_t layer, int16_t xo, int16_t yo, float rot, uint16_t size) {
-
-    float cos_pre = cosf(rot);
-    float sin_pre = sinf(rot);
-
-    if(way->data[0].block[0].nodes > 1) {
-      
-        color_t cl = rgb332(0,0,0);
-        uint8_t th = 1;
-
-        for(uint8_t t = 0; t < way->n_tags; t++) {
-            switch(((uint8_t*)way->tag_ids)[t]) {
-                case 26: // Pedestrian
-                case 13: // Steps
-                    cl = rgb332(0xE5,0xE0,0xC2);
-                    th = 1;
-                    goto tag_found;
-                case 3: // Footway
-                case 4: // Path
-                    cl = rgb332(0xAA,0x00,0x00);
-                    th = 1;
-                    goto tag_found;
-                case 2: // Track
-                    cl = rgb332(0xFF,0xFA,0xF2);
-                    th = 1;
-                    goto tag_found;                    
-                case 14: // Cycleway
-                    cl = rgb332(0xFF,0xF2,0xDE);
-                    th = 1;
-                    goto tag_found;
-                case 32: // Bridleway
-                    cl = rgb332(0xD3,0xCB,0x98);
-                    th = 1;
-                    goto tag_found;           
-                case 0: // Service
-                    cl = rgb332(0xFF,0xFF,0xFF);
-                    th = 1;
-                    goto tag_found;          
-                case 28: // Construction
-                    cl = rgb332(0xD0,0xD0,0xD0);
-                    th = 1;
-                    goto tag_found;    
-                case 64: // Road
-                    cl = rgb332(0xD0,0xD0,0xD0);
-                    th = 2;
-                    goto tag_found;              
-                case 1: // Residential
-                case 6: // Unclassified
-                case 30: // Living Street
-                    cl = rgb332(0xFF,0xFF,0xFF);
-                    th = 2;
-                    goto tag_found;         
-                case 8:  // Tertiary
-                case 35: // Tertiary Link
-                    cl = rgb332(0xFF,0xFF,0x90);
-                    th = 3;
-                    goto tag_found;    
-                case 12: // Secondary
-                case 34: // Secondary Link
-                    cl = rgb332(0xBB,0x85,0x0F);
-                    th = 3;
-                    goto tag_found;
-                case 7: // Primary
-                    cl = rgb332(0xFE,0x85,0x0C);
-                    th = 4;
-                    goto tag_found;
-                case 27: // Primary Link
-                    cl = rgb332(0xFE,0x85,0x0C);
-                    th = 3;
-                    goto tag_found;   
-                case 11: // Trunk
-                    cl = rgb332(0x80,0x00,0x40);
-                    th = 4;
-                    goto tag_found;
-                case 24: // Trunk Link
-                    cl = rgb332(0x80,0x00,0x40);
-                    th = 3;
-                    goto tag_found;    
-                case 21: // Motorway
-                    cl = rgb332(0x40,0x00,0x00);
-                    th = 3;
-                    goto tag_found;
-                case 23: // Motorway Link
-                    cl = rgb332(0x40,0x00,0x00);
-                    th = 3;
-                    goto tag_found;  
-                //default:
-                    ////ESP_LOGI(TAG,"Tag %d Not Found: %hu\n", t, way->tag_ids[t]);
-            } 
+void map_view_init(map_view_t * v, float rot, uint16_t w, uint16_t h) {
+    v->cos_r = lroundf(cosf(rot)*(1 << MAP_VIEW_BITS));
+    v->sin_r = lroundf(sinf(rot)*(1 << MAP_VIEW_BITS));
+    v->w = w;
+    v->h = h;
+    v->xo = 0;
+    v->yo = 0;
+}
+
+// Points too far off screen for int16 are held at its limits.
+static inline int16_t view_clamp(int32_t v) {
+    if(v < INT16_MIN) return INT16_MIN;
+    if(v > INT16_MAX) return INT16_MAX;
+    return v;
+}
+
+// Turn a tile pixel position about the screen centre, rounding to the
+// nearest pixel, without holding it to int16.
+static inline void view_point_wide(const map_view_t * v, way_coord p, int32_t * x, int32_t * y) {
+    int32_t xt = p.x+v->xo-v->w/2;
+    int32_t yt = p.y+v->yo-v->h/2;
+    int32_t round = 1 << (MAP_VIEW_BITS-1);
+
+    *x = ((xt*v->cos_r-yt*v->sin_r+round) >> MAP_VIEW_BITS)+v->w/2;
+    *y = ((yt*v->cos_r+xt*v->sin_r+round) >> MAP_VIEW_BITS)+v->h/2;
+}
+
+static inline way_coord view_point(const map_view_t * v, way_coord p) {
+    int32_t x, y;
+    way_coord s;
+
+    view_point_wide(v, p, &x, &y);
+    s.x = view_clamp(x);
+    s.y = view_clamp(y);
+    return s;
+}
+
+// Whether a screen point was held at the int16 limits.
+static inline int view_clamped(way_coord s) {
+    return s.x == INT16_MIN || s.x == INT16_MAX || s.y == INT16_MIN || s.y == INT16_MAX;
+}
+
+// Whether box b of tile pixels, grown by margin, reaches the screen under
+// view v. Separating axis test on the tile's axes and the turned screen's,
+// worked in half pixels about the screen centre.
+int map_view_box_visible(const map_view_t * v, const way_box * b, int16_t margin) {
+    if(b->x0 > b->x1) return 0;
+
+    int32_t qx = b->x0+b->x1+2*(v->xo-v->w/2);
+    int32_t qy = b->y0+b->y1+2*(v->yo-v->h/2);
+    int32_t hx = b->x1-b->x0+2*margin;
+    int32_t hy = b->y1-b->y0+2*margin;
+    int32_t ac = abs(v->cos_r);
+    int32_t as = abs(v->sin_r);
+
+    // The screen's reach along the tile's axes, rounded up.
+    if(abs(qx) > hx+((v->w*ac+v->h*as) >> MAP_VIEW_BITS)+1) return 0;
+    if(abs(qy) > hy+((v->w*as+v->h*ac) >> MAP_VIEW_BITS)+1) return 0;
+
+    // The box's reach along the screen's.
+    int64_t u = (int64_t)qx*v->cos_r-(int64_t)qy*v->sin_r;
+    int64_t w = (int64_t)qy*v->cos_r+(int64_t)qx*v->sin_r;
+    if(llabs(u) > ((int64_t)v->w << MAP_VIEW_BITS)+(int64_t)hx*ac+(int64_t)hy*as) return 0;
+    if(llabs(w) > ((int64_t)v->h << MAP_VIEW_BITS)+(int64_t)hx*as+(int64_t)hy*ac) return 0;
+
+    return 1;
+}
+
+// Mark the ways listed in grid cells that reach the screen, so the rest
+// are passed over without looking at their boxes.
+static void view_mark_ways(const map_view_t * v, const map_tile_t * tile, int16_t margin) {
+    memset(tile->grid_mark, 0, (tile->n_ways+7)/8);
+
+    for(int cy = 0; cy < TILE_GRID; cy++) {
+        for(int cx = 0; cx < TILE_GRID; cx++) {
+            uint32_t c = cy*TILE_GRID+cx;
+            if(tile->grid_start[c] == tile->grid_start[c+1]) continue;
+
+            // Worked out wide, cells of a big tile reach past int16.
+            int32_t x0 = tile->box.x0+((int32_t)cx << tile->grid_shift);
+            int32_t y0 = tile->box.y0+((int32_t)cy << tile->grid_shift);
+            way_box cell;
+            cell.x0 = view_clamp(x0);
+            cell.y0 = view_clamp(y0);
+            cell.x1 = view_clamp(x0+(1 << tile->grid_shift)-1);
+            cell.y1 = view_clamp(y0+(1 << tile->grid_shift)-1);
+            if(!map_view_box_visible(v, &cell, margin)) continue;
+
+            for(uint32_t i = tile->grid_start[c]; i < tile->grid_start[c+1]; i++) {
+                uint16_t w = tile->grid_ways[i];
+                tile->grid_mark[w >> 3] |= 1 << (w & 7);
+            }
         }
-        tag_found:
+    }
+}
 
-        for(int i = 0; i < (way->data[0].block[0].nodes-1); i++) {
-            int16_t xt0 = xo+way->data[0].block[0].coords[i].x-DISPLAY_WIDTH/2;
-            int16_t yt0 = yo+way->data[0].block[0].coords[i].y-DISPLAY_HEIGHT/2;
+// Move every node and POI of a tile onto the screen in one pass, so a way
+// drawn twice (casing and fill) doesn't redo the sums. Nodes are skipped
+// when the tile's box grown by margin misses the screen, returns 0 then
+// and the tile's ways aren't to be drawn. Otherwise the ways near the
+// screen are marked in the tile's grid.
+int map_view_transform(const map_view_t * v, const map_tile_t * tile, int16_t margin) {
+    int visible = map_view_box_visible(v, &tile->box, margin);
+
+    if(!visible) PROF_COUNT(PROF_TILES_CULLED);
+    else {
+        if(tile->grid_start) view_mark_ways(v, tile, margin);
+        if(tile->screen) {
+            for(uint32_t i = 0; i < tile->n_coords; i++) tile->screen[i] = view_point(v, tile->coords[i]);
+        }
+    }
+    if(tile->poi_screen) {
+        for(uint16_t p = 0; p < tile->n_pois; p++) tile->poi_screen[p] = view_point(v, tile->poi_coord[p]);
+    }
 
-            int16_t xt1 = xo+way->data[0].block[0].coords[i+1].x-DISPLAY_WIDTH/2;
-            int16_t yt1 = yo+way->data[0].block[0].coords[i+1].y-DISPLAY_HEIGHT/2;
+    return visible;
+}
 
-            if(cl != 0) draw_varthick_line( xt0*cos_pre-yt0*sin_pre+DISPLAY_WIDTH/2, 
-                                            yt0*cos_pre+xt0*sin_pre+DISPLAY_HEIGHT/2,
-                                            xt1*cos_pre-yt1*sin_pre+DISPLAY_WIDTH/2, 
-                                            yt1*cos_pre+xt1*sin_pre+DISPLAY_HEIGHT/2, th, cl);
+// Screen position of node i, moved as it is asked for if the tile had no
+// room to keep them.
+static inline way_coord node_screen(const map_tile_t * tile, const map_view_t * v, uint32_t i) {
+    return tile->screen ? tile->screen[i] : view_point(v, tile->coords[i]);
+}
 
-            /*if(cl != 0) hagl_draw_line( xt0*cos_pre-yt0*sin_pre+DISPLAY_WIDTH/2, 
-                                            yt0*cos_pre+xt0*sin_pre+DISPLAY_HEIGHT/2,
-                                            xt1*cos_pre-yt1*sin_pre+DISPLAY_WIDTH/2, 
-                                            yt1*cos_pre+xt1*sin_pre+DISPLAY_HEIGHT/2, cl);*/
+static inline way_coord poi_screen(const map_tile_t * tile, const map_view_t * v, uint16_t p) {
+    return tile->poi_screen ? tile->poi_screen[p] : view_point(v, tile->poi_coord[p]);
+}
 
-            /*if(cl != 0) hagl_draw_line(way->data[0].block[0].coords[i].x, 
-                                       way->data[0].block[0].coords[i].y,
-                                       way->data[0].block[0].coords[i+1].x,
-                                       way->data[0].block[0].coords[i+1].y, cl);*/
+// Scratch for the way being drawn, its screen points and the edges hagl
+// builds from them. Lines and areas share it.
+static int16_t shape_vertices[MAP_AREA_MAX_EDGES*2];
+static uint16_t shape_ends[MAP_AREA_MAX_EDGES/3];
+static hagl_edge_t shape_edges[MAP_AREA_MAX_EDGES];
+
+// Points stroked in one pass, each takes up to 6 edges of the outline.
+#define WAY_STROKE_POINTS (MAP_AREA_MAX_EDGES/6)
+
+#define CLIP_START 2
+#define CLIP_END 4
+
+// Cut the segment from (x0, y0) to (x1, y1) down to the part inside the
+// screen grown by g on every side (Liang-Barsky). Returns 0 if none of it
+// is, otherwise 1 with CLIP_START or CLIP_END set for the ends moved.
+static int clip_segment(const map_view_t * v, int32_t g, int32_t * x0, int32_t * y0, int32_t * x1, int32_t * y1) {
+    float dx = *x1-*x0;
+    float dy = *y1-*y0;
+    float p[4] = { -dx, dx, -dy, dy };
+    float q[4] = { *x0+g, v->w+g-*x0, *y0+g, v->h+g-*y0 };
+    float t0 = 0;
+    float t1 = 1;
+
+    for(int k = 0; k < 4; k++) {
+        if(p[k] == 0) {
+            if(q[k] < 0) return 0;
+            continue;
         }
-    }   
+        float r = q[k]/p[k];
+        if(p[k] < 0) {
+            if(r > t1) return 0;
+            if(r > t0) t0 = r;
+        } else {
+            if(r < t0) return 0;
+            if(r < t1) t1 = r;
+        }
+    }
+
+    int cut = 1;
+    int32_t sx = *x0;
+    int32_t sy = *y0;
+    if(t1 < 1) {
+        *x1 = sx+lroundf(t1*dx);
+        *y1 = sy+lroundf(t1*dy);
+        cut |= CLIP_END;
+    }
+    if(t0 > 0) {
+        *x0 = sx+lroundf(t0*dx);
+        *y0 = sy+lroundf(t0*dy);
+        cut |= CLIP_START;
+    }
+    return cut;
 }
 
-int load_map(arena_t* a0, char* filename, way_prop** way_list_ptr, uint32_t x_in, uint32_t y_in, uint32_t z_in, int16_t xo, int16_t yo, uint16_t st, float rot, float size) {
-    fb_handler fbh;
-    if(init_buffer(&fbh, filename)) {
-        //ESP_LOGI(TAG,"Failed to init file buffer\n\r");
-        return 1;
+// Add a point to the line being gathered in shape_vertices, skipping it if
+// it lands on the same pixel as the one before.
+static void stroke_point(uint16_t * n, int16_t x, int16_t y, uint8_t th, color_t cl) {
+    if(*n > 0 && x == shape_vertices[*n*2-2] && y == shape_vertices[*n*2-1]) return;
+
+    // Long ways go in several passes. The last segment is carried
+    // over so the join at the cut is drawn, painting it twice.
+    if(*n == WAY_STROKE_POINTS) {
+        draw_thick_polyline(*n, shape_vertices, th, shape_edges, cl);
+        memcpy(shape_vertices, &shape_vertices[*n*2-4], sizeof(int16_t)*4);
+        *n = 2;
+    }
+
+    shape_vertices[*n*2] = x;
+    shape_vertices[*n*2+1] = y;
+    (*n)++;
+}
+
+void g_draw_way(const map_tile_t * tile, uint16_t w, color_t cl, uint8_t th, const map_view_t * v) {
+    uint32_t c_end;
+    uint32_t c0 = tile_way_coords(tile, w, &c_end);
+
+    if(cl == 0 || c_end - c0 < 2) return;
+
+    // Miters reach out to twice the half width past the nodes.
+    if(!map_view_box_visible(v, &tile->block_box[tile->way_block[w]], 2*th+1)) {
+        PROF_COUNT(PROF_WAYS_CULLED);
+        return;
+    }
+    PROF_COUNT(PROF_WAYS_DRAWN);
+
+    uint16_t n = 0;
+    way_coord prev = { 0, 0 };
+
+    for(uint32_t i = c0; i < c_end; i++) {
+        way_coord s = node_screen(tile, v, i);
+        int s_far = view_clamped(s);
+        int prev_far = i > c0 && view_clamped(prev);
+
+        if(i == c0 || !(s_far || prev_far)) {
+            if(!s_far) stroke_point(&n, s.x, s.y, th, cl);
+            prev = s;
+            continue;
+        }
+
+        // A node too far off screen for int16 would be moved by clamping,
+        // so segments reaching it are worked out again in full and cut
+        // where they leave the screen, far enough out that the ends and
+        // joins there aren't seen. The line is broken at the cut.
+        int32_t x0, y0, x1, y1;
+        view_point_wide(v, tile->coords[i-1], &x0, &y0);
+        view_point_wide(v, tile->coords[i], &x1, &y1);
+        int cut = clip_segment(v, 2*th+2, &x0, &y0, &x1, &y1);
+
+        if(!cut) {
+            draw_thick_polyline(n, shape_vertices, th, shape_edges, cl);
+            n = 0;
+        } else {
+            if(prev_far) stroke_point(&n, x0, y0, th, cl);
+            if(s_far) stroke_point(&n, x1, y1, th, cl);
+        }
+        if(!s_far) stroke_point(&n, s.x, s.y, th, cl);
+        else {
+            draw_thick_polyline(n, shape_vertices, th, shape_edges, cl);
+            n = 0;
+        }
+        prev = s;
+    }
+
+    draw_thick_polyline(n, shape_vertices, th, shape_edges, cl);
+}
+
+// Fill every ring of every block of way w as one shape under the even-odd
+// rule, so inner rings cut holes and multi-block ways come out whole.
+// Returns 1 if the way has more edges than the scratch holds, or reaches
+// too far off screen for hagl's coordinates.
+int g_fill_area(const map_tile_t * tile, uint16_t w, color_t cl, const map_view_t * v) {
+    uint16_t n_rings = 0;
+    uint16_t n = 0;
+
+    // Blocks off screen are left out whole, holes and all.
+    for(uint16_t b = tile->way_block[w]; b < tile->way_block[w+1]; b++) {
+        if(!map_view_box_visible(v, &tile->block_box[b], 1)) continue;
+
+        for(uint16_t p = tile->block_poly[b]; p < tile->block_poly[b+1]; p++) {
+            uint32_t c0 = tile->poly_coord[p];
+            uint32_t c1 = tile->poly_coord[p+1];
+            if(c1 - c0 < 3) continue;
+
+            // Rings are closed implicitly, a repeated first node is harmless.
+            if(c1 - c0 > (uint32_t)(MAP_AREA_MAX_EDGES - n)) return 1;
+
+            for(uint32_t i = c0; i < c1; i++) {
+                way_coord s = node_screen(tile, v, i);
+
+                if(view_clamped(s)) return 1;
+
+                shape_vertices[n*2] = s.x;
+                shape_vertices[n*2+1] = s.y;
+                n++;
+            }
+            shape_ends[n_rings++] = n;
+        }
+    }
+
+    if(n_rings == 0) {
+        PROF_COUNT(PROF_WAYS_CULLED);
+        return 0;
+    }
+    PROF_COUNT(PROF_WAYS_DRAWN);
+
+    hagl_fill_rings(n_rings, shape_ends, shape_vertices, shape_edges, cl);
+
+    return 0;
+}
+
+// One layer of a tile in draw order. Drawing every tile's casing pass for a
+// layer before any fill pass keeps casings from covering the neighbouring
+// tile's roads. Areas (styles with no width) are filled during the casing
+// pass, underneath every line on their layer, and outlined in their casing.
+void g_draw_layer(const map_tile_t * tile, const style_table_t * stt, uint8_t layer, uint8_t casing, uint8_t zoom, const map_view_t * v) {
+    for(uint16_t i = tile->layer_start[layer]; i < tile->layer_start[layer+1]; i++) {
+        uint16_t w = tile->draw_order[i];
+        const way_style_t * style = &stt->style[tile->style[w]];
+
+        if(!style_visible(style, zoom)) continue;
+
+        if(style->width == 0) {
+            if(!casing || !tile_way_closed(tile, w)) continue;
+        } else if(casing && !style->casing) continue;
+
+        if(tile->grid_mark && !(tile->grid_mark[w >> 3] & (1 << (w & 7)))) {
+            PROF_COUNT(PROF_WAYS_CULLED);
+            continue;
+        }
+
+        if(style->width == 0) {
+            if(g_fill_area(tile, w, style->colour, v)) ESP_LOGW(TAG, "Area %u is too large to fill", w);
+            if(style->casing) g_draw_way(tile, w, style->casing, 1, v);
+            continue;
+        }
+
+        if(!casing) g_draw_way(tile, w, style->colour, style->width, v);
+        else g_draw_way(tile, w, style->casing, style->width+2, v);
+    }
+}
+
+// Symbols for a tile's POIs, a dot of the style's width outlined in its casing.
+void g_draw_pois(const map_tile_t * tile, const style_table_t * stt, uint8_t zoom, const map_view_t * v) {
+    for(uint16_t p = 0; p < tile->n_pois; p++) {
+        const way_style_t * style = &stt->style[tile->poi_style[p]];
+        if(!style_visible(style, zoom) || style->width == 0) continue;
+
+        way_coord s = poi_screen(tile, v, p);
+        int16_t sx = s.x;
+        int16_t sy = s.y;
+
+        hagl_fill_circle(sx, sy, style->width, style->colour);
+        if(style->casing) hagl_draw_circle(sx, sy, style->width, style->casing);
+    }
+}
+
+static wchar_t utf8_next(const char ** s) {
+    const uint8_t * c = (const uint8_t *)*s;
+
+    if(c[0] < 0x80) {
+        *s += 1;
+        return c[0];
+    }
+    if((c[0] & 0xE0) == 0xC0 && (c[1] & 0xC0) == 0x80) {
+        *s += 2;
+        return ((c[0] & 0x1F) << 6) | (c[1] & 0x3F);
+    }
+
+    // Longer sequences are outside the font, skip the lead and continuation bytes.
+    do { (*s)++; } while((**s & 0xC0) == 0x80);
+    return '?';
+}
+
+// Names right of their symbol, drawn after every tile's symbols so nothing
+// paints over them. Labels that would collide with one already placed this
+// frame or run off screen are left out.
+void g_draw_poi_labels(const map_tile_t * tile, const style_table_t * stt, uint8_t zoom, const map_view_t * v, label_set_t * ls) {
+    fontx_meta_t meta;
+    if(fontx_meta(&meta, font5x7)) return;
+
+    for(uint16_t p = 0; p < tile->n_pois && ls->n < MAP_MAX_LABELS; p++) {
+        const way_style_t * style = &stt->style[tile->poi_style[p]];
+        if(tile->poi_name[p] == 0 || !style_visible(style, zoom)) continue;
+
+        const char * name = tile->poi_strings + tile->poi_name[p];
+
+        int len = 0;
+        for(const char * c = name; *c; len++) utf8_next(&c);
+
+        way_coord s = poi_screen(tile, v, p);
+        int16_t sx = s.x;
+        int16_t sy = s.y;
+
+        int16_t box[4] = { sx + style->width + 2, sy - meta.height/2, 0, 0 };
+        box[2] = box[0] + len*meta.width;
+        box[3] = box[1] + meta.height;
+
+        if(box[0] < 0 || box[1] < 0 || box[2] > v->w || box[3] > v->h) continue;
+
+        int clear = 1;
+        for(int l = 0; l < ls->n && clear; l++) {
+            const int16_t * b = ls->box[l];
+            if(box[0] < b[2] && box[2] > b[0] && box[1] < b[3] && box[3] > b[1]) clear = 0;
+        }
+        if(!clear) continue;
+
+        memcpy(ls->box[ls->n++], box, sizeof(box));
+
+        int16_t x = box[0];
+        for(const char * c = name; *c; ) x += hagl_put_char(utf8_next(&c), x, box[1], rgb332(255,255,255), font5x7);
+    }
+}
+
+// Read a tag name list into one packed pool of NUL terminated strings.
+static int read_tag_table(cursor_t * c, tag_table_t * tt) {
+    tt->n_tags = get_uint16(c);
+    tt->offset = malloc(sizeof(uint16_t)*tt->n_tags);
+
+    size_t capacity = 16*tt->n_tags + 1;
+    size_t used = 0;
+    tt->pool = malloc(capacity);
+
+    if(tt->offset == NULL || tt->pool == NULL) return 1;
+
+    for(int tag = 0; tag < tt->n_tags; tag++) {
+        uint32_t str_len = get_vbe_uint(c);
+
+        if(used + str_len + 1 > UINT16_MAX) return 1;
+
+        if(used + str_len + 1 > capacity) {
+            while(used + str_len + 1 > capacity) capacity *= 2;
+            char * pool = realloc(tt->pool, capacity);
+            if(pool == NULL) return 1;
+            tt->pool = pool;
+        }
+
+        // Copied whole, get_string() only takes a byte of length.
+        if(cursor_remaining(c) < str_len) return 1;
+
+        tt->offset[tag] = used;
+        memcpy(tt->pool + used, c->ptr, str_len);
+        cursor_skip(c, str_len);
+        tt->pool[used + str_len] = '\0';
+        used += str_len + 1;
     }
 
-    ////ESP_LOGI(TAG,"Read in %d Bytes\n\r", fbh.bytes_read);
+    // Give back the slack, the table lives as long as the handle.
+    char * pool = realloc(tt->pool, used ? used : 1);
+    if(pool != NULL) tt->pool = pool;
 
-    if(memcmp(fbh.buffer_ptr, MAPSFORGE_MAGIC_STRING, 20)) {
+    return 0;
+}
+
+static void free_tag_table(tag_table_t * tt) {
+    free(tt->offset);
+    free(tt->pool);
+    tt->offset = NULL;
+    tt->pool = NULL;
+    tt->n_tags = 0;
+}
+
+int open_map(map_handle_t * mh, char * filename) {
+    PROF_START(PROF_HEADER);
+
+    map_reader_t * rd = &mh->rd;
+    mapsforge_file_header * hdr = &mh->hdr;
+    cursor_t cur;
+    cursor_t * c = &cur;
+
+    memset(hdr, 0, sizeof(mapsforge_file_header));
+    memset(&mh->style, 0, sizeof(style_table_t));
+    memset(&mh->poi_style, 0, sizeof(style_table_t));
+    mh->filter = NULL;
+    mh->pois = 0;
+    mh->simplify = 1;
+
+    if(reader_open(rd, filename)) {
+        //ESP_LOGI(TAG,"Failed to open map file\n\r");
+        return 1;
+    }
+
+    if(reader_span(rd, c, 0, 24) || memcmp(c->ptr, MAPSFORGE_MAGIC_STRING, 20)) {
         //ESP_LOGI(TAG,"Not a valid .MAP file!\n\r");
+        reader_close(rd);
         return -1;
-    } else {
-        ////ESP_LOGI(TAG,"Valid .MAP: %s\n\r", fbh.buffer_ptr);
     }
 
-    fbh.buffer_pos += 20;
+    cursor_skip(c, 20);
 
-    mapsforge_file_header hdr;
+    hdr->header_size = get_uint32(c);
+    //ESP_LOGI(TAG,"Header Size:%d\n\r", hdr->header_size);
+
+    if(reader_span(rd, c, 24, hdr->header_size)) {
+        reader_close(rd);
+        return -1;
+    }
 
-    hdr.header_size = get_uint32(&fbh);
-    //ESP_LOGI(TAG,"Header Size:%d\n\r", hdr.header_size);
-    hdr.file_version = get_uint32(&fbh);
-    //ESP_LOGI(TAG,"File Version:%d\n\r", hdr.file_version);
-    hdr.file_size = get_uint64(&fbh);
-    //ESP_LOGI(TAG,"File Size:%uMB\n\r", (uint8_t)(hdr.file_size/1000000));
-    hdr.file_creation = get_int64(&fbh);
-    //ESP_LOGI(TAG,"File Created:%llu\n\r", (uint64_t)hdr.file_creation/1000);
-    hdr.bounding_box[0] = get_int32(&fbh);
-    hdr.bounding_box[1] = get_int32(&fbh);
-    hdr.bounding_box[2] = get_int32(&fbh);
-    hdr.bounding_box[3] = get_int32(&fbh);
+    hdr->file_version = get_uint32(c);
+    //ESP_LOGI(TAG,"File Version:%d\n\r", hdr->file_version);
+    hdr->file_size = get_uint64(c);
+    //ESP_LOGI(TAG,"File Size:%uMB\n\r", (uint8_t)(hdr->file_size/1000000));
+    hdr->file_creation = get_int64(c);
+    //ESP_LOGI(TAG,"File Created:%llu\n\r", (uint64_t)hdr->file_creation/1000);
+    hdr->bounding_box[0] = get_int32(c);
+    hdr->bounding_box[1] = get_int32(c);
+    hdr->bounding_box[2] = get_int32(c);
+    hdr->bounding_box[3] = get_int32(c);
     //ESP_LOGI(TAG,"Bounding Box:\n\r");
-    //ESP_LOGI(TAG,"\t[0]:%7.3f\n\r\t[1]:%7.3f\n\r\t[2]:%7.3f\n\r\t[3]:%7.3f\n\r", (float)hdr.bounding_box[0]/1000000, (float)hdr.bounding_box[1]/1000000, (float)hdr.bounding_box[2]/1000000, (float)hdr.bounding_box[3]/1000000);
-    hdr.tile_size = get_uint16(&fbh);
-    //ESP_LOGI(TAG,"Tile Size:\t%hhu\n\r", hdr.tile_size);
+    //ESP_LOGI(TAG,"\t[0]:%7.3f\n\r\t[1]:%7.3f\n\r\t[2]:%7.3f\n\r\t[3]:%7.3f\n\r", (float)hdr->bounding_box[0]/1000000, (float)hdr->bounding_box[1]/1000000, (float)hdr->bounding_box[2]/1000000, (float)hdr->bounding_box[3]/1000000);
+    hdr->tile_size = get_uint16(c);
+    //ESP_LOGI(TAG,"Tile Size:\t%hhu\n\r", hdr->tile_size);
 
-    uint8_t str_len = get_uint8(&fbh);
-    get_string(&fbh, hdr.projection,str_len);
-    //ESP_LOGI(TAG,"Projection:\t%s\n\r", hdr.projection);
+    uint8_t str_len = get_uint8(c);
+    get_string(c, hdr->projection,str_len);
+    //ESP_LOGI(TAG,"Projection:\t%s\n\r", hdr->projection);
 
-    hdr.flags = get_uint8(&fbh);
+    hdr->flags = get_uint8(c);
 
-    if(hdr.flags & 0x40) {
-        hdr.init_lat_long[0] = get_uint32(&fbh);
-        hdr.init_lat_long[1] = get_uint32(&fbh);
+    if(hdr->flags & 0x40) {
+        hdr->init_lat_long[0] = get_uint32(c);
+        hdr->init_lat_long[1] = get_uint32(c);
         //ESP_LOGI(TAG,"Start Position:\n\r");
-        //ESP_LOGI(TAG,"\t[0]:%7.3f\n\r\t[1]:%7.3f\n\r", (float)hdr.init_lat_long[0]/1000000, (float)hdr.init_lat_long[1]/1000000);
+        //ESP_LOGI(TAG,"\t[0]:%7.3f\n\r\t[1]:%7.3f\n\r", (float)hdr->init_lat_long[0]/1000000, (float)hdr->init_lat_long[1]/1000000);
     } else {
-        hdr.init_lat_long[0] = 0;
-        hdr.init_lat_long[1] = 0;
+        hdr->init_lat_long[0] = 0;
+        hdr->init_lat_long[1] = 0;
     }
 
-    if(hdr.flags & 0x20) {
-        hdr.init_zoom = get_uint8(&fbh);    
-        //ESP_LOGI(TAG,"Start Zoom:\t%u\n\r", hdr.init_zoom);
+    if(hdr->flags & 0x20) {
+        hdr->init_zoom = get_uint8(c);    
+        //ESP_LOGI(TAG,"Start Zoom:\t%u\n\r", hdr->init_zoom);
     } else {
-        hdr.init_zoom = 0;
+        hdr->init_zoom = 0;
     }
 
-    if(hdr.flags & 0x10) {
-        str_len = get_uint8(&fbh);
-        get_string(&fbh, hdr.lang_pref,str_len);
-        //ESP_LOGI(TAG,"Language:\t%s\n\r", hdr.lang_pref); 
+    if(hdr->flags & 0x10) {
+        str_len = get_uint8(c);
+        get_string(c, hdr->lang_pref,str_len);
+        //ESP_LOGI(TAG,"Language:\t%s\n\r", hdr->lang_pref); 
     } else {
-        hdr.lang_pref[0] = '\0';
+        hdr->lang_pref[0] = '\0';
     }
 
-    if(hdr.flags & 0x08) {
-        str_len = get_uint8(&fbh);
-        get_string(&fbh, hdr.comment, str_len);    
-        //ESP_LOGI(TAG,"Comment:\t%s\n\r", fbh.buffer_pos, hdr.comment);
+    if(hdr->flags & 0x08) {
+        str_len = get_uint8(c);
+        get_string(c, hdr->comment, str_len);    
+        //ESP_LOGI(TAG,"Comment:\t%s\n\r", hdr->comment);
     } else {
-        hdr.comment[0] = '\0';
+        hdr->comment[0] = '\0';
     }
 
-    if(hdr.flags & 0x04) {
-        str_len = get_uint8(&fbh);
-        get_string(&fbh, hdr.created_by, str_len);
-        //ESP_LOGI(TAG,"Created By:\t%s\n\n\r", hdr.created_by);
+    if(hdr->flags & 0x04) {
+        str_len = get_uint8(c);
+        get_string(c, hdr->created_by, str_len);
+        //ESP_LOGI(TAG,"Created By:\t%s\n\n\r", hdr->created_by);
     } else {
-        hdr.created_by[0] = '\0';
+        hdr->created_by[0] = '\0';
     }
 
-    hdr.n_poi_tags = get_uint16(&fbh);
-
-    //ESP_LOGI(TAG,"# of POI Tags:\t%hhu\n\r", hdr.n_poi_tags);
+    if(read_tag_table(c, &hdr->poi_tags) || read_tag_table(c, &hdr->way_tags)) {
+        ESP_LOGE(TAG, "Failed to allocate tag table");
+        close_map(mh);
+        return -1;
+    }
 
-    for(int poi_id = 0; poi_id < hdr.n_poi_tags; poi_id++) {
-        str_len = get_uint8(&fbh);
-        get_string(&fbh, hdr.poi_tag_names[poi_id], str_len);
-        //ESP_LOGI(TAG,"\t[%d]: %d : %s\n", poi_id, str_len, hdr.poi_tag_names[poi_id]);
+    if(map_set_theme(mh, NULL)) {
+        close_map(mh);
+        return -1;
     }
 
-    hdr.n_way_tags = get_uint16(&fbh);
+    //ESP_LOGI(TAG,"# of POI Tags:\t%hu, # of Way Tags:\t%hu\n\r", hdr->poi_tags.n_tags, hdr->way_tags.n_tags);
 
-    //ESP_LOGI(TAG,"# of Way Tags:\t%d\n\r", hdr.n_way_tags);
- 
-    for(int way_id = 0; way_id < hdr.n_way_tags; way_id++) {
-        str_len = get_uint8(&fbh);
-        get_string(&fbh, hdr.way_tag_names[way_id], str_len);
-        //ESP_LOGI(TAG,"\t[%d]: %s\n\r", way_id, hdr.way_tag_names[way_id]);
-    }
+    hdr->n_zoom_intervals = get_uint8(c);
 
-    hdr.n_zoom_intervals = get_uint8(&fbh);
+    if(hdr->n_zoom_intervals > MAP_MAX_ZOOM_INTERVALS) {
+        ESP_LOGE(TAG, "%u zoom intervals, only %d supported", hdr->n_zoom_intervals, MAP_MAX_ZOOM_INTERVALS);
+        close_map(mh);
+        return -1;
+    }
 
-    //ESP_LOGI(TAG,"\n# Zoom Intervals:\t%u\n\r", hdr.n_zoom_intervals);
+    //ESP_LOGI(TAG,"\n# Zoom Intervals:\t%u\n\r", hdr->n_zoom_intervals);
 
-    for(int zoom_id = 0; zoom_id < hdr.n_zoom_intervals; zoom_id++) {
-        hdr.zoom_conf[zoom_id].base_zoom = get_uint8(&fbh);
-        hdr.zoom_conf[zoom_id].min_zoom = get_uint8(&fbh);
-        hdr.zoom_conf[zoom_id].max_zoom = get_uint8(&fbh);
-        hdr.zoom_conf[zoom_id].sub_file = get_uint64(&fbh);
-        hdr.zoom_conf[zoom_id].sub_file_size = get_uint64(&fbh);
+    for(int zoom_id = 0; zoom_id < hdr->n_zoom_intervals; zoom_id++) {
+        hdr->zoom_conf[zoom_id].base_zoom = get_uint8(c);
+        hdr->zoom_conf[zoom_id].min_zoom = get_uint8(c);
+        hdr->zoom_conf[zoom_id].max_zoom = get_uint8(c);
+        hdr->zoom_conf[zoom_id].sub_file = get_uint64(c);
+        hdr->zoom_conf[zoom_id].sub_file_size = get_uint64(c);
 
-        hdr.zoom_conf[zoom_id].n_tiles_x = (long2tilex(((double)hdr.bounding_box[3])/1000000, hdr.zoom_conf[zoom_id].base_zoom) - long2tilex(((double)hdr.bounding_box[1])/1000000, hdr.zoom_conf[zoom_id].base_zoom)) + 1;
-        hdr.zoom_conf[zoom_id].n_tiles_y = (lat2tiley(((double)hdr.bounding_box[0])/1000000, hdr.zoom_conf[zoom_id].base_zoom) - lat2tiley(((double)hdr.bounding_box[2])/1000000, hdr.zoom_conf[zoom_id].base_zoom)) + 1;
+        hdr->zoom_conf[zoom_id].tile_x0 = long2tilex(((double)hdr->bounding_box[1])/1000000, hdr->zoom_conf[zoom_id].base_zoom);
+        hdr->zoom_conf[zoom_id].tile_y0 = lat2tiley(((double)hdr->bounding_box[2])/1000000, hdr->zoom_conf[zoom_id].base_zoom);
+        hdr->zoom_conf[zoom_id].n_tiles_x = (long2tilex(((double)hdr->bounding_box[3])/1000000, hdr->zoom_conf[zoom_id].base_zoom) - hdr->zoom_conf[zoom_id].tile_x0) + 1;
+        hdr->zoom_conf[zoom_id].n_tiles_y = (lat2tiley(((double)hdr->bounding_box[0])/1000000, hdr->zoom_conf[zoom_id].base_zoom) - hdr->zoom_conf[zoom_id].tile_y0) + 1;
 
         //ESP_LOGI(TAG,"Zoom Interval [%d]:\n\r", zoom_id);
-        //ESP_LOGI(TAG,"\tBase Zoom: %u\n\r", hdr.zoom_conf[zoom_id].base_zoom);
-        //ESP_LOGI(TAG,"\tMax Zoom: %u\n\r", hdr.zoom_conf[zoom_id].max_zoom);
-        //ESP_LOGI(TAG,"\tMin Zoom: %u\n\r", hdr.zoom_conf[zoom_id].min_zoom);
-        //ESP_LOGI(TAG,"\tSub-file Start: %llu\n\r", hdr.zoom_conf[zoom_id].sub_file);
-        //ESP_LOGI(TAG,"\tSub-file Size: %fMB\n\r", (float)hdr.zoom_conf[zoom_id].sub_file_size/1000000);
-        //ESP_LOGI(TAG,"\t# of Tiles in X: %u\n\r", hdr.zoom_conf[zoom_id].n_tiles_x);
-        //ESP_LOGI(TAG,"\t# of Tiles in Y: %u\n\r", hdr.zoom_conf[zoom_id].n_tiles_y);
-        //ESP_LOGI(TAG,"\t# of Tiles: %u\n\r", hdr.zoom_conf[zoom_id].n_tiles_y * hdr.zoom_conf[zoom_id].n_tiles_x );
-        //ESP_LOGI(TAG,"\tOSM Base Tile Origin: %d/%d/%d\n\r", hdr.zoom_conf[zoom_id].base_zoom, long2tilex(((double)hdr.bounding_box[1])/1000000, hdr.zoom_conf[zoom_id].base_zoom), lat2tiley(((double)hdr.bounding_box[2])/1000000, hdr.zoom_conf[zoom_id].base_zoom));
+        //ESP_LOGI(TAG,"\tBase Zoom: %u\n\r", hdr->zoom_conf[zoom_id].base_zoom);
+        //ESP_LOGI(TAG,"\tMax Zoom: %u\n\r", hdr->zoom_conf[zoom_id].max_zoom);
+        //ESP_LOGI(TAG,"\tMin Zoom: %u\n\r", hdr->zoom_conf[zoom_id].min_zoom);
+        //ESP_LOGI(TAG,"\tSub-file Start: %llu\n\r", hdr->zoom_conf[zoom_id].sub_file);
+        //ESP_LOGI(TAG,"\tSub-file Size: %fMB\n\r", (float)hdr->zoom_conf[zoom_id].sub_file_size/1000000);
+        //ESP_LOGI(TAG,"\t# of Tiles in X: %u\n\r", hdr->zoom_conf[zoom_id].n_tiles_x);
+        //ESP_LOGI(TAG,"\t# of Tiles in Y: %u\n\r", hdr->zoom_conf[zoom_id].n_tiles_y);
+        //ESP_LOGI(TAG,"\t# of Tiles: %u\n\r", hdr->zoom_conf[zoom_id].n_tiles_y * hdr->zoom_conf[zoom_id].n_tiles_x );
+        //ESP_LOGI(TAG,"\tOSM Base Tile Origin: %d/%d/%d\n\r", hdr->zoom_conf[zoom_id].base_zoom, long2tilex(((double)hdr->bounding_box[1])/1000000, hdr->zoom_conf[zoom_id].base_zoom), lat2tiley(((double)hdr->bounding_box[2])/1000000, hdr->zoom_conf[zoom_id].base_zoom));
     }
-    
-    int z_ds;
-    for(z_ds = 0; z_ds < hdr.n_zoom_intervals; z_ds++)
-        if((z_in > hdr.zoom_conf[z_ds].min_zoom) && \
-           (z_in < hdr.zoom_conf[z_ds].max_zoom)) break;
 
-    //ESP_LOGI(TAG,"Zoom Interval:%d\n\r", z_ds);    
-
-    uint32_t x_ds = x_in - long2tilex(((double) hdr.bounding_box[1])/1000000, hdr.zoom_conf[z_ds].base_zoom);
-    uint32_t y_ds = y_in - lat2tiley(((double) hdr.bounding_box[2])/1000000, hdr.zoom_conf[z_ds].base_zoom);
+    if(c->error) {
+        ESP_LOGE(TAG, "Truncated map header");
+        close_map(mh);
+        return -1;
+    }
 
-    uint32_t t_lookup = ((y_ds*hdr.zoom_conf[z_ds].n_tiles_x) + x_ds);
+    PROF_END(PROF_HEADER);
 
-    const uint64_t addr_mask =  0x7fffffffffULL;
-    const uint64_t water_mask = 0x8000000000ULL;
+    return 0;
+}
 
-    file_seek(&fbh, hdr.zoom_conf[z_ds].sub_file+(t_lookup*5));
-    uint64_t addr_lookup = get_varint(&fbh, 5);
-    uint64_t offset_lookup = addr_lookup & addr_mask;
+void close_map(map_handle_t * mh) {
+    free_tag_table(&mh->hdr.poi_tags);
+    free_tag_table(&mh->hdr.way_tags);
+    style_table_free(&mh->style);
+    style_table_free(&mh->poi_style);
+    reader_close(&mh->rd);
+}
 
-    if(addr_lookup & water_mask) {
-      //ESP_LOGI(TAG,"Only Water\n");
-      //ESP_LOGI(TAG,"Arena: %d/%d\n\r", arena_free(&a0), ARENA_DEFAULT_SIZE);
-      file_close(&fbh);
-      return 0;
+// Recompile the style tables against this file's way and POI tags, NULL
+// restores the built in rules. Tiles decoded before the call keep their old
+// style indices.
+int map_set_theme(map_handle_t * mh, const theme_t * theme) {
+    const style_rule_t * rules = theme ? theme->rules : style_default_rules;
+    int n_rules = theme ? theme->n_rules : style_default_n_rules;
+
+    style_table_free(&mh->style);
+    style_table_free(&mh->poi_style);
+    if(style_table_init(&mh->style, &mh->hdr.way_tags, rules, n_rules) || \
+       style_table_init(&mh->poi_style, &mh->hdr.poi_tags, rules, n_rules)) {
+        ESP_LOGE(TAG, "Failed to allocate style table");
+        return -1;
     }
-        
-    //ESP_LOGI(TAG,"%u/%d/%d -> %lu, %llu, %llu\n\r", hdr.zoom_conf[z_ds].base_zoom, x_in, y_in, t_lookup, offset_lookup, addr_lookup&water_mask);
-    
-    file_seek(&fbh, hdr.zoom_conf[z_ds].sub_file+offset_lookup);
 
-    uint16_t pois[22] = {0};
-    uint16_t ways[22] = {0};
+    return 0;
+}
 
-    //ESP_LOGI(TAG,"Z\tPOIs\tWays\n\r");
-    for(int z = hdr.zoom_conf[z_ds].min_zoom; z <= hdr.zoom_conf[z_ds].max_zoom; z++) {
-        pois[z] = get_vbe_uint(&fbh);
-        ways[z] = get_vbe_uint(&fbh);
-        //ESP_LOGI(TAG,"%d\t%d\t%d\n\r", z, pois[z], ways[z]);
+// Interval holding zoom, or the deepest one when zooming in past all of them.
+// Returns the interval index, -1 if zoom is below every interval.
+int map_tile_grid(const mapsforge_file_header * hdr, uint8_t zoom, map_tile_grid_t * g) {
+    int z_ds = -1;
+    for(int z = 0; z < hdr->n_zoom_intervals; z++) {
+        const mapsforge_zoom_interval * zi = &hdr->zoom_conf[z];
+        if(zoom >= zi->min_zoom && zoom <= zi->max_zoom) {
+            z_ds = z;
+            break;
+        }
+        if(zoom > zi->max_zoom && (z_ds < 0 || zi->max_zoom > hdr->zoom_conf[z_ds].max_zoom)) z_ds = z;
     }
-    //ESP_LOGI(TAG,"Zoom Table End\n\r");
-    
-    uint32_t first_way_offset = get_vbe_uint(&fbh);
-    uint32_t first_way_file_addr = hdr.zoom_conf[z_ds].sub_file + \
-                                         offset_lookup + \
-                                         fbh.buffer_pos + \
-                                         first_way_offset;
-
-    //ESP_LOGI(TAG,"First Way Offset: %lu - %lu\n\r", first_way_offset, first_way_file_addr);
-    file_seek(&fbh, first_way_file_addr);                                   
-
-    int ways_to_draw = ways[12];//+ways[13]+ways[14]+ways[15];
-    *way_list_ptr = arena_malloc(a0, sizeof(way_prop)*ways_to_draw);
-    uint32_t way_size = 0;
-    
+
+    if(z_ds < 0) return -1;
+
+    const mapsforge_zoom_interval * zi = &hdr->zoom_conf[z_ds];
+    uint8_t d = (zoom > zi->base_zoom) ? zoom - zi->base_zoom : 0;
+
+    g->z = zi->base_zoom + d;
+    g->base_zoom = zi->base_zoom;
+    g->x0 = zi->tile_x0 << d;
+    g->y0 = zi->tile_y0 << d;
+    g->n_x = (uint32_t)zi->n_tiles_x << d;
+    g->n_y = (uint32_t)zi->n_tiles_y << d;
+
+    return z_ds;
+}
+
+// Subtiles of a base tile covered by tile x/y d zooms below it. The bitmap
+// is a 4x4 grid two zooms below base, top left subtile in the high bit.
+static uint16_t subtile_mask(uint32_t x, uint32_t y, uint8_t d) {
+    if(d == 0) return 0xFFFF;
+
+    uint8_t span = (d == 1) ? 2 : 1;
+    uint32_t sx = (d == 1) ? (x & 1)*2 : (x >> (d-2)) & 3;
+    uint32_t sy = (d == 1) ? (y & 1)*2 : (y >> (d-2)) & 3;
+
+    uint16_t mask = 0;
+    for(uint32_t r = sy; r < sy + span; r++)
+        for(uint32_t c = sx; c < sx + span; c++) mask |= 0x8000 >> (r*4 + c);
+
+    return mask;
+}
+
+// Tile edges in microdegrees, kept in double so offsets between a base tile
+// and a deep over-zoom tile inside it don't lose precision.
+static int32_t tile_lon_md(uint32_t x, uint8_t z) {
+    return lround((x / (double)(1 << z) * 360.0 - 180.0)*1000000.0);
+}
+
+static int32_t tile_lat_md(uint32_t y, uint8_t z) {
+    double n = M_PI - 2.0*M_PI*y / (double)(1 << z);
+    return lround(180.0/M_PI*atan(sinh(n))*1000000.0);
+}
+
+// Metres per pixel that fit the tile into size x size pixels, for each axis.
+void map_tile_fit(uint32_t x_in, uint32_t y_in, uint32_t z_in, float size, float * scale, float * x_scale) {
     double lon = tilex2long(x_in,z_in);
     double lat = tiley2lat(y_in,z_in);
   
@@ -357,33 +748,208 @@ int load_map(arena_t* a0, char* filename, way_prop** way_list_ptr, uint32_t x_in
     int y_pix = lat_to_y(latdiff*1000000, 1);
     float x_mercator = ((float)x_pix/y_pix);
     float fit_scale = y_pix/size;
-    int x_fit = lon_to_x(londiff*1000000, x_mercator*fit_scale);
-    int y_fit = lat_to_y(latdiff*1000000, fit_scale);
     
     //ESP_LOGI(TAG,"scale diff to: %d, %d\n", y_pix, x_pix);
     //ESP_LOGI(TAG,"scale factors: %f, %f (%f)\n", fit_scale, x_mercator*fit_scale, x_mercator);
-    //ESP_LOGI(TAG,"fit diff tile: %d, %d\n", y_fit, x_fit);
-      
-    for(int w = 0; w < ways_to_draw; w++) {
-        uint8_t rtn = get_way(*way_list_ptr+w,&fbh,a0, st, fit_scale, x_mercator);
-        if(rtn) { // Ignore way
-          if(w > 0) w--; 
-          ways_to_draw--;  
+
+    *scale = fit_scale;
+    *x_scale = x_mercator*fit_scale;
+}
+
+// Keep ways tagged with any of the given "key=value" names, on any layer.
+int map_filter_init(way_filter_t * wf, const tag_table_t * tags, const char * const * names, int n_names) {
+    wf->min_layer = 0;
+    wf->max_layer = 15;
+    wf->n_tags = tags->n_tags;
+    wf->tag_mask = calloc((tags->n_tags + 7)/8 + 1, 1);
+
+    if(wf->tag_mask == NULL) return 1;
+
+    int found = 0;
+    for(int n = 0; n < n_names; n++) {
+        for(int id = 0; id < tags->n_tags; id++) {
+            if(strcmp(tag_name(tags, id), names[n]) == 0) {
+                wf->tag_mask[id >> 3] |= 1 << (id & 7);
+                found++;
+            }
+        }
+    }
+
+    return found ? 0 : -1;
+}
+
+void map_filter_free(way_filter_t * wf) {
+    free(wf->tag_mask);
+    wf->tag_mask = NULL;
+}
+
+int map_load_tile(map_handle_t * mh, arena_t * a0, map_tile_t * tile, uint32_t x_in, uint32_t y_in, uint32_t z_in, uint16_t st, float size) {
+    PROF_START(PROF_LOOKUP);
+
+    memset(tile, 0, sizeof(map_tile_t));
+
+    mapsforge_file_header * hdr = &mh->hdr;
+    cursor_t cur;
+    cursor_t * c = &cur;
+
+    map_tile_grid_t g;
+    int z_ds = map_tile_grid(hdr, z_in, &g);
+
+    //ESP_LOGI(TAG,"Zoom Interval:%d\n\r", z_ds);    
+
+    if(z_ds < 0) {
+        PROF_END(PROF_LOOKUP);
+        return -1;
+    }
+
+    if(x_in - g.x0 >= g.n_x || y_in - g.y0 >= g.n_y) {
+        PROF_END(PROF_LOOKUP);
+        return 0;
+    }
+
+    mapsforge_zoom_interval * zi = &hdr->zoom_conf[z_ds];
+
+    // Over-zoomed tiles come out of the base tile holding them, with only
+    // the ways in their subtiles kept. Nodes are int16 pixels relative to
+    // the drawn tile, so the whole base tile has to fit in that range.
+    uint8_t d = g.z - g.base_zoom;
+    uint32_t x_base = x_in >> d;
+    uint32_t y_base = y_in >> d;
+
+    if(size*(1 << d) > INT16_MAX) {
+        ESP_LOGE(TAG, "Can't over-zoom %u levels at %.0f px", d, size);
+        PROF_END(PROF_LOOKUP);
+        return -1;
+    }
+
+    st &= subtile_mask(x_in, y_in, d);
+
+    uint32_t x_ds = x_base - zi->tile_x0;
+    uint32_t y_ds = y_base - zi->tile_y0;
+
+    uint32_t t_lookup = ((y_ds*zi->n_tiles_x) + x_ds);
+
+    const uint64_t addr_mask =  0x7fffffffffULL;
+    const uint64_t water_mask = 0x8000000000ULL;
+
+    uint32_t n_tiles = zi->n_tiles_x*zi->n_tiles_y;
+
+    // This entry and the next bound the tile, the last tile runs to the end of the sub-file.
+    reader_span(&mh->rd, c, zi->sub_file+(t_lookup*5), (t_lookup+1 < n_tiles) ? 10 : 5);
+    uint64_t addr_lookup = get_varint(c, 5);
+    uint64_t offset_lookup = addr_lookup & addr_mask;
+    uint64_t offset_end = (t_lookup+1 < n_tiles) ? (get_varint(c, 5) & addr_mask) : zi->sub_file_size;
+
+    if(c->error || offset_end < offset_lookup) {
+        ESP_LOGE(TAG, "Bad tile index %lu/%lu", (unsigned long)x_in, (unsigned long)y_in);
+        PROF_END(PROF_LOOKUP);
+        return -1;
+    }
+
+    if(addr_lookup & water_mask) {
+      //ESP_LOGI(TAG,"Only Water\n");
+      //ESP_LOGI(TAG,"Arena: %d/%d\n\r", arena_free(&a0), ARENA_DEFAULT_SIZE);
+      PROF_END(PROF_LOOKUP);
+      return 0;
+    }
+        
+    //ESP_LOGI(TAG,"%u/%d/%d -> %lu, %llu, %llu\n\r", hdr->zoom_conf[z_ds].base_zoom, x_in, y_in, t_lookup, offset_lookup, addr_lookup&water_mask);
+    
+    if(reader_span(&mh->rd, c, zi->sub_file+offset_lookup, offset_end-offset_lookup)) {
+        ESP_LOGE(TAG, "Failed to read tile %lu/%lu", (unsigned long)x_in, (unsigned long)y_in);
+        PROF_END(PROF_LOOKUP);
+        return -1;
+    }
+
+    // POIs and ways are stored in order of the zoom they first appear at,
+    // so the counts up to the requested zoom give how many to read. Anything
+    // past it is never touched.
+    uint32_t pois_to_draw = 0;
+    uint32_t ways_to_draw = 0;
+
+    //ESP_LOGI(TAG,"Z\tPOIs\tWays\n\r");
+    for(uint32_t z = zi->min_zoom; z <= zi->max_zoom; z++) {
+        uint32_t pois = get_vbe_uint(c);
+        uint32_t ways = get_vbe_uint(c);
+        if(z <= z_in) {
+            pois_to_draw += pois;
+            ways_to_draw += ways;
         }
+        //ESP_LOGI(TAG,"%d\t%d\t%d\n\r", z, pois, ways);
     }
+    //ESP_LOGI(TAG,"Zoom Table End\n\r");
+
+    if(pois_to_draw > UINT16_MAX) pois_to_draw = UINT16_MAX;
+    if(ways_to_draw > UINT16_MAX) ways_to_draw = UINT16_MAX;
+    
+    uint32_t first_way_offset = get_vbe_uint(c);
+
+    // POIs sit between here and the first way, one skip when not wanted.
+    cursor_t poi_cur = *c;
+    poi_cur.end = (first_way_offset < cursor_remaining(c)) ? c->ptr + first_way_offset : c->end;
 
-    file_close(&fbh);
+    //ESP_LOGI(TAG,"First Way Offset: %lu\n\r", first_way_offset);
+    cursor_skip(c, first_way_offset);
 
-    /*for(int w = 0; w < ways_to_draw; w++) {
-        if(st & testway[w].subtile_bitmap)
-            g_draw_way(&testway[w], 0, testway[w].tag_ids[0], xo+DISPLAY_WIDTH/2, yo+DISPLAY_HEIGHT/2, rot, size);
-    }*/
+    PROF_END(PROF_LOOKUP);
+    PROF_START(PROF_DECODE);
+
+    float fit_scale, x_scale;
+    map_tile_fit(x_in, y_in, g.z, size, &fit_scale, &x_scale);
+
+    proj_t pj;
+    proj_init(&pj, fit_scale, x_scale);
+#ifdef MAPMINI_MERCATOR
+    proj_init_mercator(&pj, tiley2lat(y_in,g.z), tiley2lat(y_in+1,g.z), size);
+#endif
+    if(d) {
+        pj.lat_off = tile_lat_md(y_base, g.base_zoom) - tile_lat_md(y_in, g.z);
+        pj.lon_off = tile_lon_md(x_base, g.base_zoom) - tile_lon_md(x_in, g.z);
+    }
+
+    int rtn = decode_ways(tile, c, a0, ways_to_draw, st, mh->filter, &mh->style, &pj, mh->simplify);
+    if(rtn == 2) { // Truncated ways, keep the rest
+        ESP_LOGW(TAG, "Tile %lu/%lu truncated, %d ways kept", (unsigned long)x_in, (unsigned long)y_in, tile->n_ways);
+    }
+
+    if(rtn == 3) {
+        PROF_END(PROF_DECODE);
+        ESP_LOGE(TAG, "Tile %lu/%lu doesn't fit in %d bytes", (unsigned long)x_in, (unsigned long)y_in, a0->size);
+        return -1;
+    }
+
+    // Ways are the map, a tile whose POIs don't fit is still drawn without them.
+    if(mh->pois && decode_pois(tile, &poi_cur, a0, pois_to_draw, size, &mh->poi_style, &pj) == 3) {
+        ESP_LOGW(TAG, "Tile %lu/%lu POIs don't fit in %d bytes", (unsigned long)x_in, (unsigned long)y_in, a0->size);
+    }
+
+    // Screen positions go last in whatever room the tile left, without it
+    // nodes are moved as each way is drawn instead.
+    arena_align(a0, sizeof(way_coord));
+    if(arena_left(a0) >= sizeof(way_coord)*(tile->n_coords+tile->n_pois)) {
+        tile->screen = arena_malloc(a0, sizeof(way_coord)*tile->n_coords);
+        tile->poi_screen = arena_malloc(a0, sizeof(way_coord)*tile->n_pois);
+    }
+
+    PROF_END(PROF_DECODE);
 
     //ESP_LOGI(TAG,"Size of Ways: %d\n\r", way_size);
     
     //ESP_LOGI(TAG,"Arena: %d/%d\n\r", arena_free(&a0), ARENA_DEFAULT_SIZE);
 
+    return tile->n_ways;
+}
+
+int load_map(arena_t* a0, char* filename, map_tile_t * tile, uint32_t x_in, uint32_t y_in, uint32_t z_in, int16_t xo, int16_t yo, uint16_t st, float rot, float size) {
+    map_handle_t mh;
+
+    int rtn = open_map(&mh, filename);
+    if(rtn) {
+        return rtn;
+    }
 
+    rtn = map_load_tile(&mh, a0, tile, x_in, y_in, z_in, st, size);
+    close_map(&mh);
 
-    return ways_to_draw;
+    return rtn;
 }
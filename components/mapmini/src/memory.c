@@ -2,10 +2,8 @@
 #include <stdio.h>
 #include <esp_log.h>
 
-volatile uint8_t reg[ARENA_DEFAULT_SIZE];
-
-void arena_init(arena_t * arena, size_t size) {
-    arena->region = (uint8_t *)&reg;
+void arena_init_buffer(arena_t * arena, uint8_t * buffer, size_t size) {
+    arena->region = buffer;
     arena->size = sizeof(uint8_t)*size;
     arena->current = 0;
 }
@@ -24,9 +22,26 @@ void* arena_malloc(arena_t * arena, size_t size) {
     return (void *) (tmp);
 }
 
+// Round the next allocation up to a multiple of align (a power of two) from
+// the start of the region.
+void arena_align(arena_t * arena, size_t align) {
+    arena->current = (arena->current + align - 1) & ~(align - 1);
+    if(arena->current > arena->size) arena->current = arena->size;
+}
+
 size_t arena_free(arena_t * arena) { // Invalidates existing pointers
     size_t oldsize = arena->current;
     arena->current = 0;
     //free(arena->region);
     return oldsize;
-}
\ No newline at end of file
+}
+
+// Bytes still free for arena_malloc().
+size_t arena_left(arena_t * arena) {
+    return arena->size - arena->current;
+}
+
+// Give back the last size bytes, the end of the latest allocation.
+void arena_shrink(arena_t * arena, size_t size) {
+    arena->current = (size < arena->current) ? arena->current - size : 0;
+}
@@ -1,143 +1,61 @@
 #include "parse.h"
 
-uint8_t get_uint8(fb_handler * fbh) {
-    // Don't overflow the buffer, reload it.
-    if(!get_remaining_bytes(fbh)) {
-        load_buffer(fbh);
-    } 
-    
-    uint8_t byte = *((uint8_t*)(fbh->buffer_ptr + fbh->buffer_pos));
-    fbh->buffer_pos++;
-
-    return byte;
-}
-
-uint16_t get_uint16(fb_handler * fbh) {
-    uint8_t len = 2;
-    uint16_t val;
-
-    // Check Highwater, reload buffer if needed
-    if(fbh->buffer_pos + len > FILE_READ_BUFFER_SIZE) {
-        relative_reset_buffer(fbh, FILE_READ_BUFFER_SIZE - fbh->buffer_pos);
+// Big endian fixed width read, one bounds check per value.
+static inline uint64_t get_be(cursor_t * c, uint8_t len) {
+    if(cursor_remaining(c) < len) {
+        c->ptr = c->end;
+        c->error = 1;
+        return 0;
     }
 
-    val = *((uint16_t*)(fbh->buffer_ptr + fbh->buffer_pos));
-    fbh->buffer_pos += len;
-    return __builtin_bswap16(val);
-}
-
-uint32_t get_uint32(fb_handler * fbh) {
-    uint8_t len = 4;
-    uint32_t val;
-
-        // Check Highwater, reload buffer if needed
-    if(fbh->buffer_pos + len > FILE_READ_BUFFER_SIZE) {
-        relative_reset_buffer(fbh, FILE_READ_BUFFER_SIZE - fbh->buffer_pos);
+    uint64_t val = 0;
+    for(int i = 0; i < len; i++) {
+        val = (val << 8) | c->ptr[i];
     }
+    c->ptr += len;
 
-    val = *((uint32_t*)(fbh->buffer_ptr + fbh->buffer_pos));
-    fbh->buffer_pos += len;
-
-    return __builtin_bswap32(val);
+    return val;
 }
 
-uint64_t get_uint64(fb_handler * fbh) {
-    uint8_t len = 8;
-    uint64_t val;
-
-    // Check Highwater, reload buffer if needed
-    if(fbh->buffer_pos + len > FILE_READ_BUFFER_SIZE) {
-        relative_reset_buffer(fbh, FILE_READ_BUFFER_SIZE - fbh->buffer_pos);
-    }
-
-    val = *((uint64_t*)(fbh->buffer_ptr + fbh->buffer_pos));
-    fbh->buffer_pos += len;
-
-    return __builtin_bswap64(val);
+uint16_t get_uint16(cursor_t * c) {
+    return get_be(c, 2);
 }
 
-int_least8_t get_int8(fb_handler * fbh) {
-    // Don't overflow the buffer, reload it.
-    if(!get_remaining_bytes(fbh)) {
-        load_buffer(fbh);
-    }
-
-    int_least8_t val = *((int_least8_t*)(fbh->buffer_ptr + fbh->buffer_pos));
-    fbh->buffer_pos++;
-
-    return val;
+uint32_t get_uint32(cursor_t * c) {
+    return get_be(c, 4);
 }
 
-int16_t get_int16(fb_handler * fbh) {
-    uint8_t len = 2;
-    int16_t val;
-
-    // Check Highwater, reload buffer if needed
-    if(fbh->buffer_pos + len > FILE_READ_BUFFER_SIZE) {
-        relative_reset_buffer(fbh, FILE_READ_BUFFER_SIZE - fbh->buffer_pos);
-    }
-
-    val = *((int16_t*)(fbh->buffer_ptr + fbh->buffer_pos));
-    fbh->buffer_pos += len;
-    return __builtin_bswap16(val);
+uint64_t get_uint64(cursor_t * c) {
+    return get_be(c, 8);
 }
 
-int32_t get_int32(fb_handler * fbh) {
-    uint8_t len = 4;
-    int32_t val;
-
-        // Check Highwater, reload buffer if needed
-    if(fbh->buffer_pos + len > FILE_READ_BUFFER_SIZE) {
-        relative_reset_buffer(fbh, FILE_READ_BUFFER_SIZE - fbh->buffer_pos);
-    }
-
-    val = *((int32_t*)(fbh->buffer_ptr + fbh->buffer_pos));
-    fbh->buffer_pos += len;
-
-    return __builtin_bswap32(val);
+int_least8_t get_int8(cursor_t * c) {
+    return (int_least8_t)get_uint8(c);
 }
 
-int64_t get_int64(fb_handler * fbh) {
-    uint8_t len = 8;
-    int64_t val;
-
-    // Check Highwater, reload buffer if needed
-    if(fbh->buffer_pos + len > FILE_READ_BUFFER_SIZE) {
-        relative_reset_buffer(fbh, FILE_READ_BUFFER_SIZE - fbh->buffer_pos);
-    }
-
-    val = *((int64_t*)(fbh->buffer_ptr + fbh->buffer_pos));
-    fbh->buffer_pos += len;
-    
-    return __builtin_bswap64(val);
+int16_t get_int16(cursor_t * c) {
+    return (int16_t)get_be(c, 2);
 }
 
-uint64_t get_varint(fb_handler * fbh, uint8_t len) {
-    uint8_t buffer[8];
-    uint64_t val = 0;
-
-    // Check Highwater, reload buffer if needed
-    if((fbh->buffer_pos + len) > FILE_READ_BUFFER_SIZE) {
-        relative_reset_buffer(fbh, FILE_READ_BUFFER_SIZE - fbh->buffer_pos);
-    }
-
-    memcpy(&buffer, (fbh->buffer_ptr + fbh->buffer_pos), len);
-    fbh->buffer_pos += len;
+int32_t get_int32(cursor_t * c) {
+    return (int32_t)get_be(c, 4);
+}
 
-    for(int i = 0; i < len; i++) {
-        val |= ((buffer[i] &0xffL) << 8*(len-i-1)); 
-    }
+int64_t get_int64(cursor_t * c) {
+    return (int64_t)get_be(c, 8);
+}
 
-    return val;
+uint64_t get_varint(cursor_t * c, uint8_t len) {
+    return get_be(c, len);
 }
 
 // LEB128 Decode
-uint32_t get_vbe_uint(fb_handler * fbh) {
+uint32_t get_vbe_uint(cursor_t * c) {
     uint32_t val = 0;
     uint8_t shift = 0;
 
     while(shift <= 25) {
-        uint8_t byte = get_uint8(fbh);
+        uint8_t byte = get_uint8(c);
         val |= ((uint32_t)(byte & 0x7F)) << shift;
         if(!(byte & 0x80))
             break;
@@ -148,16 +66,16 @@ uint32_t get_vbe_uint(fb_handler * fbh) {
 }
 
 // LEB128 Signed Decode
-int32_t get_vbe_int(fb_handler * fbh) {
+int32_t get_vbe_int(cursor_t * c) {
     int32_t val = 0;
     uint8_t shift = 0;
     
-    uint8_t byte = get_uint8(fbh);
+    uint8_t byte = get_uint8(c);
 
     while((byte & 0x80) && (shift <= 25)) {
         val |= ((uint32_t)(byte & 0x7f)) << shift;
         shift += 7;
-        byte = get_uint8(fbh);
+        byte = get_uint8(c);
     }
 
     // Add sign bit
@@ -168,13 +86,106 @@ int32_t get_vbe_int(fb_handler * fbh) {
     return val | ((uint32_t)(byte & 0x3f) << shift);
 }
 
-void get_string(fb_handler * fbh, char * ptr, uint8_t len) {
-    // Check Highwater, reload buffer if needed
-    if(fbh->buffer_pos + len > FILE_READ_BUFFER_SIZE) {
-        relative_reset_buffer(fbh, FILE_READ_BUFFER_SIZE - fbh->buffer_pos);
+// Decode one signed varint with no bounds checks, the caller guarantees at
+// least VBE_INT_MAX_BYTES readable bytes. Same result as get_vbe_int().
+static inline int32_t vbe_int_unchecked(const uint8_t ** pp) {
+    const uint8_t * p = *pp;
+    uint32_t val;
+    uint8_t byte = p[0];
+
+    // Most deltas fit in one or two bytes
+    if(!(byte & 0x80)) {
+        *pp = p + 1;
+        val = byte & 0x3f;
+        return (byte & 0x40) ? -val : val;
+    }
+
+    if(!(p[1] & 0x80)) {
+        *pp = p + 2;
+        val = (byte & 0x7f) | ((uint32_t)(p[1] & 0x3f) << 7);
+        return (p[1] & 0x40) ? -val : val;
     }
 
-    memcpy(ptr, (fbh->buffer_ptr + fbh->buffer_pos), len);
-    fbh->buffer_pos+=len;    
+#if !defined(ESP_PLATFORM) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+    // Find the terminating byte with one scan over a word, then gather the
+    // 7-bit groups without a branch per byte.
+    uint64_t w;
+    memcpy(&w, p, sizeof(w));
+
+    uint64_t stop = ~w & 0x8080808080808080ULL;
+    int len = stop ? (__builtin_ctzll(stop) >> 3) + 1 : VBE_INT_MAX_BYTES;
+    if(len > VBE_INT_MAX_BYTES) len = VBE_INT_MAX_BYTES;
+
+    uint8_t last = p[len-1];
+    w &= (1ULL << (8*(len-1))) - 1;
+    w |= (uint64_t)(last & 0x3f) << (8*(len-1));
+
+    val = (w & 0x7f) |
+          ((w >> 1) & (0x7fULL << 7)) |
+          ((w >> 2) & (0x7fULL << 14)) |
+          ((w >> 3) & (0x7fULL << 21)) |
+          ((w >> 4) & (0x7fULL << 28));
+
+    *pp = p + len;
+    return (last & 0x40) ? -val : val;
+#else
+    uint8_t shift = 0;
+    val = 0;
+
+    while((byte & 0x80) && (shift <= 25)) {
+        val |= ((uint32_t)(byte & 0x7f)) << shift;
+        shift += 7;
+        byte = *++p;
+    }
+
+    *pp = p + 1;
+    val |= (uint32_t)(byte & 0x3f) << shift;
+    return (byte & 0x40) ? -val : val;
+#endif
+}
+
+// Decode n signed varints into out. Returns how many were decoded, less than
+// n only if the cursor ran out.
+size_t decode_vbe_int_run(cursor_t * c, int32_t * out, size_t n) {
+    const uint8_t * p = c->ptr;
+    size_t i = 0;
+
+    // Unchecked while even a run of maximum length values can't overrun.
+    // The host scan reads a full word, so leave room for that too.
+    while(i < n && (size_t)(c->end - p) >= VBE_RUN_SLACK) {
+        out[i++] = vbe_int_unchecked(&p);
+    }
+
+    c->ptr = p;
+
+    for(; i < n; i++) {
+        out[i] = get_vbe_int(c);
+        if(c->error) return i;
+    }
+
+    return n;
+}
+
+// Step over n varints without decoding them.
+void skip_vbe_run(cursor_t * c, size_t n) {
+    const uint8_t * p = c->ptr;
+
+    while(n && p < c->end) {
+        if(!(*p++ & 0x80)) n--;
+    }
+
+    c->ptr = p;
+    if(n) c->error = 1;
+}
+
+void get_string(cursor_t * c, char * ptr, uint8_t len) {
+    if(cursor_remaining(c) < len) {
+        c->ptr = c->end;
+        c->error = 1;
+        len = 0;
+    }
+
+    memcpy(ptr, c->ptr, len);
+    c->ptr += len;
     ptr[len] = '\0';
-}
\ No newline at end of file
+}
@@ -0,0 +1,156 @@
+#include "way.h"
+#include "memory.h"
+#include <string.h>
+
+typedef struct {
+    uint16_t pois_in; // POIs read without error, kept or not
+    uint16_t pois;
+    uint32_t tags;
+    uint32_t strings;
+} poi_counts;
+
+// Read a POI up to its flags. Returns 1 if it lies outside the tile being
+// drawn, which only happens when over-zooming into part of a base tile.
+static int poi_head(cursor_t * c, const proj_t * pj, float size, way_coord * pos, uint8_t * special, uint32_t * tags) {
+    int32_t lat = get_vbe_int(c) + pj->lat_off;
+    int32_t lon = get_vbe_int(c) + pj->lon_off;
+
+    *special = get_uint8(c);
+    for(int tag = 0; tag < (*special & 0x0f); tag++) {
+        tags[tag] = get_vbe_uint(c);
+    }
+
+    int32_t y = PROJ_LAT(pj, lat);
+    int32_t x = proj_lon(pj, lon);
+
+    if(x < 0 || y < 0 || x >= size || y >= size) return 1;
+
+    pos->x = x;
+    pos->y = y;
+
+    return 0;
+}
+
+// Name is kept, house number and elevation are read past.
+static void poi_strings(cursor_t * c, uint8_t flags, char * name) {
+    if(flags & 0x80) {
+        uint8_t len = get_uint8(c);
+        if(name) get_string(c, name, len);
+        else cursor_skip(c, len);
+    }
+    if(flags & 0x40) {
+        uint8_t len = get_uint8(c);
+        cursor_skip(c, len);
+    }
+    if(flags & 0x20) get_vbe_int(c);
+}
+
+static void count_pois(cursor_t c, uint16_t n_pois, float size, const proj_t * pj, poi_counts * n) {
+    memset(n, 0, sizeof(poi_counts));
+
+    for(int p = 0; p < n_pois; p++) {
+        way_coord pos;
+        uint8_t special;
+        uint32_t tags[15];
+
+        int outside = poi_head(&c, pj, size, &pos, &special, tags);
+        uint8_t flags = get_uint8(&c);
+        uint8_t len = ((flags & 0x80) && cursor_remaining(&c)) ? *c.ptr : 0;
+
+        poi_strings(&c, flags, NULL);
+
+        if(c.error) break;
+
+        n->pois_in++;
+        if(outside) continue;
+
+        n->pois++;
+        n->tags += special & 0x0f;
+        if(flags & 0x80) n->strings += len + 1;
+    }
+}
+
+// Returns 0 on success, 2 if the POI block is truncated (t keeps the POIs
+// decoded up to that point) and 3 if they don't fit in the arena. Carved
+// after the ways, so call once decode_ways() has succeeded.
+int decode_pois(map_tile_t * t, cursor_t * c, arena_t * arena, uint16_t n_pois, float size, const style_table_t * stt, const proj_t * pj) {
+    poi_counts n;
+    count_pois(*c, n_pois, size, pj, &n);
+
+    if(n.tags > UINT16_MAX || n.strings >= UINT16_MAX) return 3;
+
+    // Checked up front so a tile whose POIs don't fit gives the arena back
+    // as it was, the screen positions can still have it.
+    size_t top = arena->current;
+    arena_align(arena, sizeof(uint32_t));
+
+    size_t need = sizeof(way_coord)*n.pois + sizeof(uint16_t)*(n.pois+1) + sizeof(uint16_t)*n.tags + \
+                  sizeof(uint16_t)*n.pois + 2*sizeof(uint8_t)*n.pois + sizeof(char)*(n.strings+1);
+    if(arena_left(arena) < need) {
+        arena_shrink(arena, arena->current-top);
+        return 3;
+    }
+
+    t->poi_coord = arena_malloc(arena, sizeof(way_coord)*n.pois);
+    t->poi_tag_start = arena_malloc(arena, sizeof(uint16_t)*(n.pois+1));
+    t->poi_tags = arena_malloc(arena, sizeof(uint16_t)*n.tags);
+    t->poi_name = arena_malloc(arena, sizeof(uint16_t)*n.pois);
+    t->poi_layer = arena_malloc(arena, sizeof(uint8_t)*n.pois);
+    t->poi_style = arena_malloc(arena, sizeof(uint8_t)*n.pois);
+    t->poi_strings = arena_malloc(arena, sizeof(char)*(n.strings+1));
+
+    uint16_t p = 0;
+    uint16_t ti = 0;
+    uint16_t si = 1;
+
+    t->poi_strings[0] = '\0';
+
+    for(int in = 0; in < n.pois_in; in++) {
+        way_coord pos;
+        uint8_t special;
+        uint32_t tags[15];
+
+        int outside = poi_head(c, pj, size, &pos, &special, tags);
+        uint8_t flags = get_uint8(c);
+
+        if(outside) {
+            poi_strings(c, flags, NULL);
+            continue;
+        }
+
+        // Sized by the counting pass, only data that reads differently the
+        // second time round stops here.
+        uint8_t len = ((flags & 0x80) && cursor_remaining(c)) ? *c->ptr : 0;
+        if(p == n.pois || (uint32_t)(special & 0x0f) > n.tags - ti || (uint32_t)si + len + 1 > n.strings + 1) c->error = 1;
+        if(c->error) break;
+
+        t->poi_coord[p] = pos;
+        t->poi_layer[p] = (special & 0xf0) >> 4;
+
+        // First tag with a style decides the symbol, as for ways.
+        t->poi_style[p] = STYLE_NONE;
+        t->poi_tag_start[p] = ti;
+        for(int tag = 0; tag < (special & 0x0f); tag++) {
+            t->poi_tags[ti++] = tags[tag];
+            if(t->poi_style[p] == STYLE_NONE) t->poi_style[p] = style_lookup(stt, tags[tag]);
+        }
+
+        t->poi_name[p] = 0;
+        if(flags & 0x80) {
+            t->poi_name[p] = si;
+            si += len + 1;
+        }
+        poi_strings(c, flags, t->poi_name[p] ? t->poi_strings + t->poi_name[p] : NULL);
+
+        if(c->error) break;
+
+        p++;
+    }
+
+    t->n_pois = p;
+    t->poi_tag_start[p] = ti;
+
+    if(c->error || n.pois_in < n_pois) return 2;
+
+    return 0;
+}
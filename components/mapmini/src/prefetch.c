@@ -0,0 +1,254 @@
+#include "prefetch.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PREFETCH_MAX_CANDIDATES 64
+
+typedef struct {
+    uint32_t x;
+    uint32_t y;
+    float score;
+} prefetch_candidate;
+
+static void prefetch_signal(prefetcher_t * pf) {
+#ifdef ESP_PLATFORM
+    xTaskNotifyGive(pf->task);
+#else
+    sem_post(&pf->wake);
+#endif
+}
+
+static void prefetch_wait(prefetcher_t * pf) {
+#ifdef ESP_PLATFORM
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+#else
+    sem_wait(&pf->wake);
+#endif
+}
+
+static void prefetch_work(prefetcher_t * pf) {
+    prefetch_buf_t * buf = NULL;
+    prefetch_req_t req;
+
+    while(pf->running) {
+        prefetch_wait(pf);
+
+        // Only take a request once there is somewhere to decode it to.
+        while(pf->running) {
+            if(buf == NULL && !spsc_pop(&pf->free_bufs, &buf)) break;
+            if(!spsc_pop(&pf->requests, &req)) break;
+
+            arena_free(&buf->arena);
+            buf->req = req;
+            buf->status = map_load_tile(&pf->mh, &buf->arena, &buf->tile, req.x, req.y, req.z, req.st, req.size);
+
+            spsc_push(&pf->done, &buf);
+            buf = NULL;
+        }
+    }
+}
+
+#ifdef ESP_PLATFORM
+static void prefetch_task(void * params) {
+    prefetcher_t * pf = params;
+    prefetch_work(pf);
+    pf->stopped = 1;
+    vTaskDelete(NULL);
+}
+#else
+static void * prefetch_thread(void * params) {
+    prefetch_work(params);
+    return NULL;
+}
+#endif
+
+// Give every buffer's arena back to the cache that lent it.
+static void prefetch_give_back(prefetcher_t * pf, int n_bufs) {
+    for(int b = 0; b < n_bufs; b++) tile_cache_give_back(pf->cache, &pf->buf[b].arena);
+}
+
+int prefetch_start(prefetcher_t * pf, char * filename, tile_cache_t * tc, const theme_t * theme) {
+    memset(pf, 0, sizeof(prefetcher_t));
+
+    if(open_map(&pf->mh, filename)) return 1;
+    if(theme && map_set_theme(&pf->mh, theme)) {
+        close_map(&pf->mh);
+        return 1;
+    }
+
+    pf->cache = tc;
+    for(int b = 0; b < PREFETCH_BUFFERS; b++) {
+        if(tile_cache_lend(tc, &pf->buf[b].arena)) {
+            prefetch_give_back(pf, b);
+            close_map(&pf->mh);
+            return 1;
+        }
+    }
+
+    spsc_init(&pf->requests, pf->request_storage, sizeof(prefetch_req_t), PREFETCH_QUEUE_LEN);
+    spsc_init(&pf->done, pf->done_storage, sizeof(prefetch_buf_t *), PREFETCH_QUEUE_LEN);
+    spsc_init(&pf->free_bufs, pf->free_storage, sizeof(prefetch_buf_t *), PREFETCH_QUEUE_LEN);
+
+    for(int b = 0; b < PREFETCH_BUFFERS; b++) {
+        prefetch_buf_t * buf = &pf->buf[b];
+        spsc_push(&pf->free_bufs, &buf);
+    }
+
+    pf->running = 1;
+
+#ifdef ESP_PLATFORM
+    if(xTaskCreate(prefetch_task, "Prefetch", 4096, pf, 1, &pf->task) != pdPASS) {
+#else
+    sem_init(&pf->wake, 0, 0);
+    if(pthread_create(&pf->thread, NULL, prefetch_thread, pf)) {
+        sem_destroy(&pf->wake);
+#endif
+        pf->running = 0;
+        prefetch_give_back(pf, PREFETCH_BUFFERS);
+        close_map(&pf->mh);
+        return 1;
+    }
+
+    return 0;
+}
+
+void prefetch_stop(prefetcher_t * pf) {
+    pf->running = 0;
+    prefetch_signal(pf);
+
+#ifdef ESP_PLATFORM
+    while(!pf->stopped) vTaskDelay(1);
+#else
+    pthread_join(pf->thread, NULL);
+    sem_destroy(&pf->wake);
+#endif
+
+    // Buffers may hold arenas that were cache slots, none are freed here.
+    prefetch_give_back(pf, PREFETCH_BUFFERS);
+    close_map(&pf->mh);
+}
+
+static int req_match(const prefetch_req_t * a, uint32_t x, uint32_t y, uint8_t z, uint16_t st, float size) {
+    return a->x == x && a->y == y && a->z == z && a->st == st && a->size == size;
+}
+
+static int candidate_cmp(const void * a, const void * b) {
+    float sa = ((const prefetch_candidate *)a)->score;
+    float sb = ((const prefetch_candidate *)b)->score;
+    return (sa < sb) - (sa > sb);
+}
+
+void prefetch_update(prefetcher_t * pf, tile_cache_t * tc, viewport_t * vp, float heading) {
+    if(!pf->running || vp->n_tiles == 0) return;
+
+    map_tile_grid_t g;
+    if(map_tile_grid(&pf->mh.hdr, vp->zoom, &g) < 0) return;
+
+    uint32_t x0 = vp->tile[0].x, x1 = vp->tile[0].x;
+    uint32_t y0 = vp->tile[0].y, y1 = vp->tile[0].y;
+
+    for(int t = 1; t < vp->n_tiles; t++) {
+        if(vp->tile[t].x < x0) x0 = vp->tile[t].x;
+        if(vp->tile[t].x > x1) x1 = vp->tile[t].x;
+        if(vp->tile[t].y < y0) y0 = vp->tile[t].y;
+        if(vp->tile[t].y > y1) y1 = vp->tile[t].y;
+    }
+
+    // Ring of tiles around the visible block, ranked by how well they line
+    // up with the direction of travel.
+    float hx = sinf(heading);
+    float hy = -cosf(heading);
+    float cx = (x0 + x1)/2.0f;
+    float cy = (y0 + y1)/2.0f;
+
+    prefetch_candidate cand[PREFETCH_MAX_CANDIDATES];
+    int n_cand = 0;
+
+    for(int64_t ty = (int64_t)y0 - 1; ty <= (int64_t)y1 + 1; ty++) {
+        for(int64_t tx = (int64_t)x0 - 1; tx <= (int64_t)x1 + 1; tx++) {
+            if(tx >= x0 && tx <= x1 && ty >= y0 && ty <= y1) continue;
+            if(tx < g.x0 || tx >= g.x0 + g.n_x) continue;
+            if(ty < g.y0 || ty >= g.y0 + g.n_y) continue;
+            if(n_cand == PREFETCH_MAX_CANDIDATES) break;
+
+            float dx = tx - cx;
+            float dy = ty - cy;
+            float score = (dx*hx + dy*hy)/sqrtf(dx*dx + dy*dy);
+
+            // Tiles behind or square to the heading would only churn the cache.
+            if(score <= 0) continue;
+
+            cand[n_cand].x = tx;
+            cand[n_cand].y = ty;
+            cand[n_cand].score = score;
+            n_cand++;
+        }
+    }
+
+    qsort(cand, n_cand, sizeof(prefetch_candidate), candidate_cmp);
+
+    // Keep the look-ahead within what the cache can hold next to the
+    // visible tiles, otherwise prefetched tiles evict each other.
+    int budget = tc->n_slots - vp->n_tiles;
+    if(n_cand > budget) n_cand = budget;
+
+    int queued = 0;
+
+    for(int c = 0; c < n_cand && pf->n_pending < PREFETCH_QUEUE_LEN; c++) {
+        if(tile_cache_contains(tc, cand[c].x, cand[c].y, vp->zoom, 0xFFFF, vp->tile_px)) continue;
+
+        int pending = 0;
+        for(int p = 0; p < pf->n_pending; p++) {
+            if(req_match(&pf->pending[p], cand[c].x, cand[c].y, vp->zoom, 0xFFFF, vp->tile_px)) pending = 1;
+        }
+        if(pending) continue;
+
+        prefetch_req_t req = {
+            .x = cand[c].x,
+            .y = cand[c].y,
+            .z = vp->zoom,
+            .st = 0xFFFF,
+            .size = vp->tile_px,
+        };
+
+        if(!spsc_push(&pf->requests, &req)) break;
+
+        pf->pending[pf->n_pending++] = req;
+        queued++;
+    }
+
+    if(queued) prefetch_signal(pf);
+}
+
+int prefetch_poll(prefetcher_t * pf, tile_cache_t * tc) {
+    prefetch_buf_t * buf;
+    int adopted = 0;
+    int returned = 0;
+
+    if(!pf->running) return 0;
+
+    while(spsc_pop(&pf->done, &buf)) {
+        prefetch_req_t * req = &buf->req;
+
+        if(buf->status >= 0 && tile_cache_adopt(tc, &buf->arena, &buf->tile, req->x, req->y, req->z, req->st, req->size) == 0) {
+            adopted++;
+        }
+
+        for(int p = 0; p < pf->n_pending; p++) {
+            if(req_match(&pf->pending[p], req->x, req->y, req->z, req->st, req->size)) {
+                pf->pending[p] = pf->pending[--pf->n_pending];
+                break;
+            }
+        }
+
+        spsc_push(&pf->free_bufs, &buf);
+        returned++;
+    }
+
+    // The worker may be parked waiting for a buffer.
+    if(returned && pf->n_pending) prefetch_signal(pf);
+
+    pf->adopted += adopted;
+    return adopted;
+}
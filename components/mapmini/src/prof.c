@@ -0,0 +1,32 @@
+#include "prof.h"
+
+#ifdef MAPMINI_PROFILE
+
+#ifdef ESP_PLATFORM
+#include <esp_timer.h>
+#else
+#include <time.h>
+#endif
+
+PROF_TLS prof_counter prof_counters[PROF_N_STAGES];
+PROF_TLS uint32_t prof_counts[PROF_N_COUNTS];
+
+uint64_t prof_time_us(void) {
+#ifdef ESP_PLATFORM
+    return esp_timer_get_time();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+#endif
+}
+
+void prof_reset(void) {
+    for(int s = 0; s < PROF_N_STAGES; s++) {
+        prof_counters[s].total_us = 0;
+        prof_counters[s].calls = 0;
+    }
+    for(int n = 0; n < PROF_N_COUNTS; n++) prof_counts[n] = 0;
+}
+
+#endif
@@ -0,0 +1,50 @@
+#include "proj.h"
+#include <math.h>
+
+#include "way.h"
+
+// Split f into a 30 bit multiplier and a right shift.
+static void proj_factor(double f, int32_t * mul, uint8_t * shift) {
+    int e;
+    frexp(f, &e);
+    int s = 30 - e;
+
+    if(s < 0) s = 0;
+    if(s > 62) s = 62;
+
+    *mul = (int32_t)lround(ldexp(f, s));
+    *shift = s;
+}
+
+// Same result as -lat_to_y(lat, scale) and lon_to_x(lon, x_scale), within
+// one pixel of rounding.
+void proj_init(proj_t * pj, float scale, float x_scale) {
+    const double md_m = M_PI/180.0/1000000.0*EARTH_R_M;
+
+    proj_factor(-md_m/scale, &pj->y_mul, &pj->y_shift);
+    proj_factor(md_m/x_scale, &pj->x_mul, &pj->x_shift);
+
+    pj->seg_mul = 0;
+    pj->seg_shift = 0;
+    pj->lat_off = 0;
+    pj->lon_off = 0;
+}
+
+static double mercator_y(double lat) {
+    return log(tan(M_PI/4 + lat*M_PI/360.0));
+}
+
+// Latitude between lat0 (top) and lat1 (bottom) in degrees maps onto size
+// pixels through true Web-Mercator instead of a linear stretch.
+void proj_init_mercator(proj_t * pj, double lat0, double lat1, float size) {
+    double span = (lat0 - lat1)*1000000.0;
+    double m0 = mercator_y(lat0);
+    double k = size/(m0 - mercator_y(lat1))*256.0;
+
+    for(int s = 0; s <= PROJ_LUT_SEGMENTS; s++) {
+        double lat = lat0 - (lat0 - lat1)*s/PROJ_LUT_SEGMENTS;
+        pj->lut[s] = lround((m0 - mercator_y(lat))*k);
+    }
+
+    proj_factor(PROJ_LUT_SEGMENTS*65536.0/span, &pj->seg_mul, &pj->seg_shift);
+}
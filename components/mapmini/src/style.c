@@ -0,0 +1,186 @@
+#include "style.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <esp_log.h>
+
+#include "rgb332.h"
+
+static const char *TAG = "style";
+
+const style_rule_t style_default_rules[] = {
+    // Areas, no width fills closed ways
+    { "natural=water",          0x2050A0, 0,        0, 0, 255, 0 },
+    { "waterway=riverbank",     0x2050A0, 0,        0, 0, 255, 0 },
+    { "landuse=forest",         0x205020, 0,        0, 0, 255, 0 },
+    { "natural=wood",           0x205020, 0,        0, 0, 255, 0 },
+    { "landuse=grass",          0x306030, 0,        0, 0, 255, 0 },
+    { "leisure=park",           0x306030, 0,        0, 0, 255, 0 },
+    { "building=yes",           0x404040, 0x808080, 0, 15, 255, 0 },
+    // Lines
+    { "highway=pedestrian",     0xE5E0C2, 0,        1, 0, 255, 1 },
+    { "highway=steps",          0xE5E0C2, 0,        1, 0, 255, 1 },
+    { "highway=footway",        0xAA0000, 0,        1, 0, 255, 1 },
+    { "highway=path",           0xAA0000, 0,        1, 0, 255, 1 },
+    { "highway=track",          0xFFFAF2, 0,        1, 0, 255, 2 },
+    { "highway=cycleway",       0xFFF2DE, 0,        1, 0, 255, 2 },
+    { "highway=bridleway",      0xD3CB98, 0,        1, 0, 255, 2 },
+    { "highway=service",        0xFFFFFF, 0,        1, 0, 255, 3 },
+    { "highway=construction",   0xD0D0D0, 0,        1, 0, 255, 3 },
+    { "highway=road",           0xD0D0D0, 0,        2, 0, 255, 4 },
+    { "highway=residential",    0xFFFFFF, 0,        2, 0, 255, 4 },
+    { "highway=unclassified",   0xFFFFFF, 0,        2, 0, 255, 4 },
+    { "highway=living_street",  0xFFFFFF, 0,        2, 0, 255, 4 },
+    { "highway=tertiary",       0xFFFF90, 0x908048, 3, 0, 255, 5 },
+    { "highway=tertiary_link",  0xFFFF90, 0x908048, 3, 0, 255, 5 },
+    { "highway=secondary",      0xBB850F, 0x604008, 3, 0, 255, 6 },
+    { "highway=secondary_link", 0xBB850F, 0x604008, 3, 0, 255, 6 },
+    { "highway=primary",        0xFE850C, 0x804006, 4, 0, 255, 7 },
+    { "highway=primary_link",   0xFE850C, 0x804006, 3, 0, 255, 7 },
+    { "highway=trunk",          0x800040, 0xC06080, 4, 0, 255, 8 },
+    { "highway=trunk_link",     0x800040, 0xC06080, 3, 0, 255, 8 },
+    { "highway=motorway",       0x400000, 0xA04040, 3, 0, 255, 9 },
+    { "highway=motorway_link",  0x400000, 0xA04040, 3, 0, 255, 9 },
+    // POIs, width is the symbol radius
+    { "amenity=pub",            0xC06000, 0xFFFFFF, 2, 15, 255, 1 },
+    { "amenity=cafe",           0xC06000, 0xFFFFFF, 2, 15, 255, 1 },
+    { "amenity=restaurant",     0xC06000, 0xFFFFFF, 2, 15, 255, 1 },
+    { "amenity=parking",        0x2060FF, 0,        2, 15, 255, 1 },
+    { "shop=supermarket",       0xA040C0, 0xFFFFFF, 2, 15, 255, 1 },
+    { "tourism=hotel",          0x0080FF, 0xFFFFFF, 2, 15, 255, 1 },
+    { "natural=peak",           0x804020, 0,        2, 12, 255, 1 },
+    { "place=city",             0xFFFFFF, 0,        0, 0,  14,  1 },
+    { "place=town",             0xFFFFFF, 0,        0, 8,  15,  1 },
+    { "place=village",          0xFFFFFF, 0,        0, 12, 17,  1 },
+};
+
+const int style_default_n_rules = sizeof(style_default_rules)/sizeof(style_rule_t);
+
+// One rule per line: key=value RRGGBB width min_zoom-max_zoom priority
+// followed by an optional casing RRGGBB. Blank lines and lines starting with # are skipped.
+static int parse_rule(char * line, style_rule_t * rule) {
+    char * p = line;
+    while(*p && !isspace((unsigned char)*p)) p++;
+    if(*p == '\0' || strchr(line, '=') == NULL) return 1;
+    *p++ = '\0';
+
+    unsigned int rgb, width, z0, z1, priority, casing = 0;
+    if(sscanf(p, "%6x %u %u-%u %u %6x", &rgb, &width, &z0, &z1, &priority, &casing) < 5) return 1;
+    if(width > 253 || z0 > z1 || z1 > 255 || priority > STYLE_MAX_PRIORITY) return 1;
+
+    rule->tag = line;
+    rule->colour = rgb;
+    rule->casing = casing;
+    rule->width = width;
+    rule->min_zoom = z0;
+    rule->max_zoom = z1;
+    rule->priority = priority;
+
+    return 0;
+}
+
+int theme_load(theme_t * th, const char * filename) {
+    memset(th, 0, sizeof(theme_t));
+
+    FILE * fp = fopen(filename, "rb");
+    if(fp == NULL) {
+        ESP_LOGI(TAG, "Couldn't open %s", filename);
+        return 1;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    long len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    th->text = malloc(len + 1);
+    th->rules = malloc(sizeof(style_rule_t)*THEME_MAX_RULES);
+    if(len < 0 || th->text == NULL || th->rules == NULL || fread(th->text, 1, len, fp) != (size_t)len) {
+        fclose(fp);
+        theme_free(th);
+        return 1;
+    }
+    fclose(fp);
+    th->text[len] = '\0';
+
+    int n_line = 0;
+    for(char * line = th->text; line != NULL; ) {
+        char * next = strchr(line, '\n');
+        if(next) *next++ = '\0';
+        n_line++;
+
+        while(isspace((unsigned char)*line)) line++;
+        if(*line != '\0' && *line != '#') {
+            if(th->n_rules == THEME_MAX_RULES) {
+                ESP_LOGW(TAG, "%s: more than %d rules", filename, THEME_MAX_RULES);
+                break;
+            }
+            if(parse_rule(line, &th->rules[th->n_rules])) {
+                ESP_LOGE(TAG, "%s:%d: bad rule", filename, n_line);
+                theme_free(th);
+                return 1;
+            }
+            th->n_rules++;
+        }
+
+        line = next;
+    }
+
+    return 0;
+}
+
+void theme_free(theme_t * th) {
+    free(th->rules);
+    free(th->text);
+    th->rules = NULL;
+    th->text = NULL;
+    th->n_rules = 0;
+}
+
+// Rules become styles in order, the first rule naming a tag wins.
+int style_table_init(style_table_t * stt, const tag_table_t * tags, const style_rule_t * rules, int n_rules) {
+    memset(stt, 0, sizeof(style_table_t));
+
+    stt->n_tags = tags->n_tags;
+    stt->tag_style = calloc(tags->n_tags ? tags->n_tags : 1, sizeof(uint8_t));
+    if(stt->tag_style == NULL) return 1;
+
+    // Unstyled ways are never visible.
+    stt->style[STYLE_NONE].min_zoom = 255;
+    stt->n_styles = 1;
+
+    for(int r = 0; r < n_rules && stt->n_styles < STYLE_MAX; r++) {
+        way_style_t * s = &stt->style[stt->n_styles];
+        int used = 0;
+
+        for(int id = 0; id < tags->n_tags; id++) {
+            if(stt->tag_style[id] == STYLE_NONE && strcmp(tag_name(tags, id), rules[r].tag) == 0) {
+                stt->tag_style[id] = stt->n_styles;
+                used = 1;
+            }
+        }
+
+        // Rules for tags this file doesn't have take no slot.
+        if(!used) continue;
+
+        s->colour = rgb332(rules[r].colour >> 16, rules[r].colour >> 8, rules[r].colour);
+        if(rules[r].casing) s->casing = rgb332(rules[r].casing >> 16, rules[r].casing >> 8, rules[r].casing);
+        s->width = rules[r].width;
+        s->min_zoom = rules[r].min_zoom;
+        s->max_zoom = rules[r].max_zoom;
+        s->priority = rules[r].priority;
+        if(s->priority > STYLE_MAX_PRIORITY) s->priority = STYLE_MAX_PRIORITY;
+
+        uint8_t w = s->casing ? s->width+2 : s->width;
+        if(w > stt->max_width) stt->max_width = w;
+        stt->n_styles++;
+    }
+
+    return 0;
+}
+
+void style_table_free(style_table_t * stt) {
+    free(stt->tag_style);
+    stt->tag_style = NULL;
+    stt->n_tags = 0;
+}
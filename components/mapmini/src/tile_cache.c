@@ -0,0 +1,143 @@
+#include "tile_cache.h"
+#include <stdlib.h>
+#include <string.h>
+
+int tile_cache_init(tile_cache_t * tc, uint8_t n_slots, uint8_t n_spare, size_t slot_size) {
+    memset(tc, 0, sizeof(tile_cache_t));
+
+    if(n_slots == 0 || n_slots > TILE_CACHE_MAX_SLOTS || n_spare > TILE_CACHE_MAX_SPARE) return 1;
+
+    tc->region = malloc(slot_size*(n_slots+n_spare));
+    if(tc->region == NULL) return 1;
+
+    tc->n_slots = n_slots;
+    tc->slot_size = slot_size;
+    for(int s = 0; s < n_slots; s++) {
+        arena_init_buffer(&tc->entry[s].arena, tc->region + s*slot_size, slot_size);
+    }
+
+    tc->n_spare = n_spare;
+    for(int s = 0; s < n_spare; s++) {
+        arena_init_buffer(&tc->spare[s], tc->region + (n_slots+s)*slot_size, slot_size);
+    }
+
+    return 0;
+}
+
+void tile_cache_free(tile_cache_t * tc) {
+    free(tc->region);
+    tc->region = NULL;
+    tc->n_slots = 0;
+    tc->n_spare = 0;
+}
+
+int tile_cache_lend(tile_cache_t * tc, arena_t * arena) {
+    if(tc->n_spare == 0) return 1;
+
+    *arena = tc->spare[--tc->n_spare];
+    arena_free(arena);
+    return 0;
+}
+
+void tile_cache_give_back(tile_cache_t * tc, const arena_t * arena) {
+    if(tc->n_spare < TILE_CACHE_MAX_SPARE) tc->spare[tc->n_spare++] = *arena;
+}
+
+void tile_cache_flush(tile_cache_t * tc) {
+    for(int s = 0; s < tc->n_slots; s++) {
+        tc->entry[s].valid = 0;
+        arena_free(&tc->entry[s].arena);
+    }
+}
+
+// Returns the matching entry, or NULL with *lru set to the slot to evict.
+static tile_cache_entry_t * tile_cache_find(tile_cache_t * tc, tile_cache_entry_t ** lru, uint32_t x, uint32_t y, uint32_t z, uint16_t st, float size) {
+    *lru = &tc->entry[0];
+
+    for(int s = 0; s < tc->n_slots; s++) {
+        tile_cache_entry_t * e = &tc->entry[s];
+
+        if(e->valid && e->x == x && e->y == y && e->z == z && e->st == st && e->size == size) {
+            return e;
+        }
+
+        // Empty slots sort before any used one.
+        if(!e->valid) {
+            if((*lru)->valid) *lru = e;
+        } else if((*lru)->valid && e->last_used < (*lru)->last_used) {
+            *lru = e;
+        }
+    }
+
+    return NULL;
+}
+
+static void tile_cache_fill(tile_cache_t * tc, tile_cache_entry_t * e, const map_tile_t * tile, uint32_t x, uint32_t y, uint32_t z, uint16_t st, float size) {
+    e->valid = 1;
+    e->x = x;
+    e->y = y;
+    e->z = z;
+    e->st = st;
+    e->size = size;
+    e->last_used = tc->tick;
+    e->tile = *tile;
+}
+
+int tile_cache_get(tile_cache_t * tc, map_handle_t * mh, const map_tile_t ** tile, uint32_t x, uint32_t y, uint32_t z, uint16_t st, float size) {
+    tile_cache_entry_t * lru;
+
+    tc->tick++;
+
+    tile_cache_entry_t * e = tile_cache_find(tc, &lru, x, y, z, st, size);
+    if(e) {
+        e->last_used = tc->tick;
+        tc->hits++;
+        *tile = &e->tile;
+        return e->tile.n_ways;
+    }
+
+    tc->misses++;
+
+    arena_free(&lru->arena);
+    lru->valid = 0;
+
+    map_tile_t decoded;
+    int n = map_load_tile(mh, &lru->arena, &decoded, x, y, z, st, size);
+    if(n < 0) return n;
+
+    tile_cache_fill(tc, lru, &decoded, x, y, z, st, size);
+
+    *tile = &lru->tile;
+    return n;
+}
+
+void tile_cache_begin_frame(tile_cache_t * tc) {
+    tc->frame_tick = tc->tick + 1;
+}
+
+int tile_cache_contains(tile_cache_t * tc, uint32_t x, uint32_t y, uint32_t z, uint16_t st, float size) {
+    tile_cache_entry_t * lru;
+    return tile_cache_find(tc, &lru, x, y, z, st, size) != NULL;
+}
+
+int tile_cache_adopt(tile_cache_t * tc, arena_t * arena, const map_tile_t * tile, uint32_t x, uint32_t y, uint32_t z, uint16_t st, float size) {
+    tile_cache_entry_t * lru;
+
+    if(tile_cache_find(tc, &lru, x, y, z, st, size)) return 1;
+    if(arena->size != lru->arena.size) return -1;
+
+    // Never evict a tile drawn in the current frame.
+    if(lru->valid && lru->last_used >= tc->frame_tick) return -1;
+
+    tc->tick++;
+
+    // Swap regions, the caller gets the evicted slot's memory back.
+    arena_t evicted = lru->arena;
+    arena_free(&evicted);
+    lru->arena = *arena;
+    *arena = evicted;
+
+    tile_cache_fill(tc, lru, tile, x, y, z, st, size);
+
+    return 0;
+}
@@ -0,0 +1,171 @@
+#include "viewport.h"
+#include <math.h>
+#include <stdlib.h>
+
+
+typedef struct {
+    uint32_t x;
+    uint32_t y;
+    float dist;
+} tile_candidate;
+
+static int candidate_cmp(const void * a, const void * b) {
+    float da = ((const tile_candidate *)a)->dist;
+    float db = ((const tile_candidate *)b)->dist;
+    return (da > db) - (da < db);
+}
+
+// Separating axis test of a north up tile (relative to the screen centre)
+// against the screen rectangle rotated by rot.
+static int tile_visible(float x0, float y0, float tpx, float cos_r, float sin_r, float hw, float hh) {
+    float min_u = INFINITY, max_u = -INFINITY;
+    float min_v = INFINITY, max_v = -INFINITY;
+
+    for(int c = 0; c < 4; c++) {
+        float x = x0 + ((c & 1) ? tpx : 0);
+        float y = y0 + ((c & 2) ? tpx : 0);
+        float u = x*cos_r - y*sin_r;
+        float v = y*cos_r + x*sin_r;
+        if(u < min_u) min_u = u;
+        if(u > max_u) max_u = u;
+        if(v < min_v) min_v = v;
+        if(v > max_v) max_v = v;
+    }
+
+    return (max_u >= -hw) && (min_u <= hw) && (max_v >= -hh) && (min_v <= hh);
+}
+
+// Fractional tile of a lat/lon in microdegrees on the grid at zoom z.
+static void tile_position(int32_t lat, int32_t lon, uint8_t z, double * fx, double * fy) {
+    double n = (double)(1 << z);
+    double lat_rad = (lat/1000000.0)*M_PI/180.0;
+    *fx = ((lon/1000000.0) + 180.0)/360.0*n;
+    *fy = (1.0 - asinh(tan(lat_rad))/M_PI)/2.0*n;
+}
+
+int viewport_load(viewport_t * vp, tile_cache_t * tc, map_handle_t * mh, int32_t lat, int32_t lon, uint8_t zoom, uint16_t width, uint16_t height, float rot, float size) {
+    map_tile_grid_t g;
+    if(map_tile_grid(&mh->hdr, zoom, &g) < 0) return -1;
+
+    vp->lat = lat;
+    vp->lon = lon;
+    vp->zoom = zoom;
+    vp->tile_zoom = g.z;
+    vp->width = width;
+    vp->height = height;
+    vp->rot = rot;
+    vp->tile_px = ldexpf(size, (int)zoom - g.z);
+    vp->style = &mh->style;
+    vp->poi_style = &mh->poi_style;
+    vp->n_tiles = 0;
+
+    tile_cache_begin_frame(tc);
+
+    // Fractional tile under the centre of the screen.
+    double fx, fy;
+    tile_position(lat, lon, g.z, &fx, &fy);
+
+    // Axis aligned extent of the rotated screen.
+    float cos_r = cosf(rot);
+    float sin_r = sinf(rot);
+    float hw = width/2.0f;
+    float hh = height/2.0f;
+    float ex = hw*fabsf(cos_r) + hh*fabsf(sin_r);
+    float ey = hw*fabsf(sin_r) + hh*fabsf(cos_r);
+
+    int32_t tx0 = floor(fx - ex/vp->tile_px);
+    int32_t tx1 = floor(fx + ex/vp->tile_px);
+    int32_t ty0 = floor(fy - ey/vp->tile_px);
+    int32_t ty1 = floor(fy + ey/vp->tile_px);
+
+    // Only tiles that exist in the file.
+    if(tx0 < (int32_t)g.x0) tx0 = g.x0;
+    if(ty0 < (int32_t)g.y0) ty0 = g.y0;
+    if(tx1 >= (int32_t)(g.x0 + g.n_x)) tx1 = g.x0 + g.n_x - 1;
+    if(ty1 >= (int32_t)(g.y0 + g.n_y)) ty1 = g.y0 + g.n_y - 1;
+
+    tile_candidate cand[VIEWPORT_MAX_TILES];
+    int n_cand = 0;
+
+    for(int32_t ty = ty0; ty <= ty1; ty++) {
+        for(int32_t tx = tx0; tx <= tx1; tx++) {
+            float x0 = (tx - fx)*vp->tile_px;
+            float y0 = (ty - fy)*vp->tile_px;
+
+            if(!tile_visible(x0, y0, vp->tile_px, cos_r, sin_r, hw, hh)) continue;
+            if(n_cand == VIEWPORT_MAX_TILES) break;
+
+            float cx = x0 + vp->tile_px/2;
+            float cy = y0 + vp->tile_px/2;
+            cand[n_cand].x = tx;
+            cand[n_cand].y = ty;
+            cand[n_cand].dist = cx*cx + cy*cy;
+            n_cand++;
+        }
+    }
+
+    // Every tile has to stay resident for the frame, so never request more
+    // than the cache holds; drop the ones furthest from the centre.
+    qsort(cand, n_cand, sizeof(tile_candidate), candidate_cmp);
+    if(n_cand > tc->n_slots) n_cand = tc->n_slots;
+
+    for(int c = 0; c < n_cand; c++) {
+        viewport_tile_t * vt = &vp->tile[vp->n_tiles];
+
+        vt->x = cand[c].x;
+        vt->y = cand[c].y;
+        vt->xo = lroundf(hw + (cand[c].x - fx)*vp->tile_px);
+        vt->yo = lroundf(hh + (cand[c].y - fy)*vp->tile_px);
+        if(tile_cache_get(tc, mh, &vt->tile, vt->x, vt->y, zoom, 0xFFFF, vp->tile_px) < 0) continue;
+        vp->n_tiles++;
+    }
+
+    return vp->n_tiles;
+}
+
+// How far a lat/lon is from the centre of the viewport, in north up screen
+// pixels, so a view drawn once can be panned without loading it again.
+void viewport_offset(const viewport_t * vp, int32_t lat, int32_t lon, float * dx, float * dy) {
+    double fx0, fy0, fx, fy;
+    tile_position(vp->lat, vp->lon, vp->tile_zoom, &fx0, &fy0);
+    tile_position(lat, lon, vp->tile_zoom, &fx, &fy);
+    *dx = (fx - fx0)*vp->tile_px;
+    *dy = (fy - fy0)*vp->tile_px;
+}
+
+// Every tile is moved onto the screen once, then drawn layer by layer
+// across all tiles, casings then fills, so bridges stay on top of whatever
+// they cross regardless of which tile it came from. Tiles whose ways all
+// miss the screen, turned corners mostly, are left out of the layers. POI
+// symbols and then their labels go on top of every way.
+void viewport_draw(viewport_t * vp) {
+    map_view_t view[VIEWPORT_MAX_TILES];
+    uint8_t visible[VIEWPORT_MAX_TILES];
+    int16_t margin = 2*vp->style->max_width+1;
+
+    map_view_init(&view[0], vp->rot, vp->width, vp->height);
+    for(int t = 0; t < vp->n_tiles; t++) {
+        view[t] = view[0];
+        view[t].xo = vp->tile[t].xo;
+        view[t].yo = vp->tile[t].yo;
+        visible[t] = map_view_transform(&view[t], vp->tile[t].tile, margin);
+    }
+
+    for(int l = 0; l < TILE_LAYERS; l++) {
+        for(int pass = 1; pass >= 0; pass--) {
+            for(int t = 0; t < vp->n_tiles; t++) {
+                if(visible[t]) g_draw_layer(vp->tile[t].tile, vp->style, l, pass, vp->zoom, &view[t]);
+            }
+        }
+    }
+
+    for(int t = 0; t < vp->n_tiles; t++) {
+        g_draw_pois(vp->tile[t].tile, vp->poi_style, vp->zoom, &view[t]);
+    }
+
+    label_set_t labels;
+    labels.n = 0;
+    for(int t = 0; t < vp->n_tiles; t++) {
+        g_draw_poi_labels(vp->tile[t].tile, vp->poi_style, vp->zoom, &view[t], &labels);
+    }
+}
@@ -1,134 +1,594 @@
 #include "way.h"
 #include "memory.h"
-#include <time.h>
+#include <string.h>
 
-uint32_t get_way(way_prop * wp, fb_handler * fbh, arena_t * arena, uint16_t st, float scale, float x_mercator) {
-    uint32_t ds = get_vbe_uint(fbh);
-    //printf("Size: %d -  ", ds);
+// Totals gathered by the counting pass, sizing the tile arrays exactly.
+typedef struct {
+    uint16_t ways_in; // Ways read without error, kept or not
+    uint16_t ways;
+    uint32_t tags;
+    uint32_t blocks;
+    uint32_t polys;
+    uint32_t coords;
+    uint32_t strings;
+} way_counts;
 
-    if(fbh->buffer_pos + ds > FILE_READ_BUFFER_SIZE) {
-        relative_reset_buffer(fbh, FILE_READ_BUFFER_SIZE - fbh->buffer_pos);
+// Read a way up to its flags. Returns 1 if the subtile or filter rejects it,
+// leaving c at the next way, otherwise c is bounded to the way's bytes and
+// *next is where the following way starts.
+static int way_head(cursor_t * c, cursor_t * next, uint16_t st, const way_filter_t * wf, uint16_t * subtile, uint8_t * special, uint32_t * tags) {
+    uint32_t ds = get_vbe_uint(c);
+
+    *next = *c;
+    cursor_skip(next, ds);
+    c->end = next->ptr;
+
+    *subtile = get_uint16(c);
+
+    if(!(st & *subtile)) {
+        *c = *next;
+        return 1;
     }
 
-    wp->subtile_bitmap = get_uint16(fbh);
-    //printf("Subtile: %04X -  ", wp->subtile_bitmap);
+    *special = get_uint8(c);
+    uint8_t layer = (*special & 0xf0) >> 4;
+    uint8_t n_tags = *special & 0x0f;
 
-    if(!(st & wp->subtile_bitmap)) {
-        for(int i = 0; i<ds-2; i++) { get_uint8(fbh); } // Read through buffer.
+    if(wf && (layer < wf->min_layer || layer > wf->max_layer)) {
+        *c = *next;
         return 1;
     }
 
-    uint8_t special = get_uint8(fbh);
-    wp->osm_layer = (special & 0xf0) >> 4;
-    //printf("Layer: %d -  ", wp->osm_layer);
-    wp->n_tags = (special & 0x0f);
-
-    wp->tag_ids = arena_malloc(arena,sizeof(uint8_t)*wp->n_tags);
-    //printf("Tags: %d -  ", wp->n_tags);
-
-    for(int tag = 0; tag < wp->n_tags; tag++) {
-        wp->tag_ids[tag] = get_vbe_uint(fbh);
-        //printf("%u - ", wp->tag_ids[tag]);
-    }
-    //printf("\n");
-
-    wp->flags = get_uint8(fbh);
-
-    if(wp->flags & 0x80) { // Way Name
-        uint8_t len = get_uint8(fbh);
-        wp->name = arena_malloc(arena,sizeof(char)*len+1);
-        get_string(fbh, wp->name, len);
-        //printf("Name: %s, ", wp->name);
-    }
-    if(wp->flags & 0x40) { // House Number
-        uint8_t len = get_uint8(fbh);
-        wp->house = arena_malloc(arena,sizeof(char)*len+1);
-        get_string(fbh, wp->house, len);
-        //printf("House: %s, ", wp->house);
-    }
-    if(wp->flags & 0x20) { // Reference
-        uint8_t len = get_uint8(fbh);
-        wp->reference = arena_malloc(arena,sizeof(char)*len+1);
-        get_string(fbh, wp->reference, len);
-        //printf("Ref: %s, ", wp->reference);
-    }
-    if(wp->flags & 0x10) { // Label Position
-        wp->label_off.x = get_vbe_int(fbh);
-        wp->label_off.y = get_vbe_int(fbh);
-        //printf("LabelPos %d %d ",  wp->label_off[0],  wp->label_off[1]);
-    }
-    if(wp->flags & 0x08) { // Number of Way Data Blocks
-        wp->blocks = (uint8_t)get_vbe_uint(fbh);
-    } else {
-        wp->blocks = 1;
-    }
-    wp->data = arena_malloc(arena,sizeof(way_data)*wp->blocks);
-
-    //printf("%d Blocks ", wp->blocks);
-
-    for(int wdb = 0; wdb < wp->blocks; wdb++) {
-        wp->data[wdb].polygons = (uint32_t)get_vbe_uint(fbh);
-        //printf("%d Polygons ", wp->data[wdb].polygons);
-        wp->data[wdb].block = arena_malloc(arena,sizeof(way_coord_blk)*wp->data[wdb].polygons);
-        int32_t pd_lon, pd_lat;
-        int32_t lon, lat;
-        for(int wcb = 0; wcb < wp->data[wdb].polygons; wcb++) {
-            wp->data[wdb].block[wcb].nodes = (uint32_t)get_vbe_uint(fbh);
-            //printf("%d Nodes ", wp->data[wdb].block[wcb].nodes);
-            wp->data[wdb].block[wcb].coords = arena_malloc(arena,sizeof(way_coord)*wp->data[wdb].block[wcb].nodes);
-            
-            //printf("sizeof: %016llX, %d, %d\n", wp->data[wdb].block[wcb].coords, sizeof(way_coord)*wp->data[wdb].block[wcb].nodes, wp->data[wdb].block[wcb].nodes);
-
-            // Get Origin
-            lat = get_vbe_int(fbh);
-            lon = get_vbe_int(fbh);
-                        
-            wp->data[wdb].block[wcb].coords[0].y = -lat_to_y(lat, scale);
-            wp->data[wdb].block[wcb].coords[0].x = lon_to_x(lon, scale*x_mercator);
-            //printf("%d ", wp->data[wdb].block[wcb].coords[0][0]);
-            //printf("%d ", wp->data[wdb].block[wcb].coords[0][1]);
-
-            // Loop Coordinates
-            if(!(wp->flags & 0x04)) { // Single Delta
-                //printf("SD ");
-                for(int wc = 1; wc < wp->data[wdb].block[wcb].nodes; wc++) {
-                    lat += get_vbe_int(fbh);
-                    lon += get_vbe_int(fbh);
-                    wp->data[wdb].block[wcb].coords[wc].y = -lat_to_y(lat, scale);
-                    wp->data[wdb].block[wcb].coords[wc].x = lon_to_x(lon, scale*x_mercator);
-                    
-                    //printf("%d ", wp->data[wdb].block[wcb].coords[wc][0]);
-                    //printf("%d ", wp->data[wdb].block[wcb].coords[wc][1]);
+    int keep = (wf == NULL || wf->tag_mask == NULL);
+
+    for(int tag = 0; tag < n_tags; tag++) {
+        tags[tag] = get_vbe_uint(c);
+        if(!keep && way_filter_tag(wf, tags[tag])) keep = 1;
+    }
+
+    if(!keep) {
+        *c = *next;
+        return 1;
+    }
+
+    return 0;
+}
+
+// First pass, walks the way structure without decoding coordinates. Ways,
+// tags and strings are counted as soon as they're read, so the totals
+// cover a way that goes on to read short and is skipped. Decoding drops
+// that way again.
+static void count_ways(cursor_t c, uint16_t n_ways, uint16_t st, const way_filter_t * wf, way_counts * n) {
+    memset(n, 0, sizeof(way_counts));
+
+    for(int w = 0; w < n_ways; w++) {
+        cursor_t next;
+        uint16_t subtile;
+        uint8_t special;
+        uint32_t tags[15];
+
+        if(way_head(&c, &next, st, wf, &subtile, &special, tags)) {
+            if(c.error) break;
+            n->ways_in++;
+            continue;
+        }
+
+        n->ways++;
+        n->tags += special & 0x0f;
+
+        uint8_t flags = get_uint8(&c);
+
+        for(int s = 0; s < 3; s++) {
+            if(flags & (0x80 >> s)) { // Name, house number, reference
+                uint8_t len = get_uint8(&c);
+                n->strings += len + 1;
+                cursor_skip(&c, len);
+            }
+        }
+        if(flags & 0x10) { // Label Position
+            get_vbe_int(&c);
+            get_vbe_int(&c);
+        }
+
+        uint32_t blocks = (flags & 0x08) ? get_vbe_uint(&c) : 1;
+        uint32_t polys = 0;
+        uint32_t coords = 0;
+
+        for(uint32_t wdb = 0; wdb < blocks && !c.error; wdb++) {
+            uint32_t n_polys = get_vbe_uint(&c);
+            polys += n_polys;
+
+            for(uint32_t wcb = 0; wcb < n_polys && !c.error; wcb++) {
+                uint32_t nodes = get_vbe_uint(&c);
+
+                // Each node takes at least two bytes, don't trust a count the way can't hold.
+                if(nodes*2 > cursor_remaining(&c)) c.error = 1;
+
+                coords += nodes;
+
+                // The way's size prefix already says where the last ring ends.
+                if(wdb == blocks-1 && wcb == n_polys-1) break;
+                skip_vbe_run(&c, 2*nodes);
+            }
+        }
+
+        n->ways_in++;
+
+        if(c.error) {
+            if(next.error) break;
+            c = next;
+            continue;
+        }
+
+        n->blocks += blocks;
+        n->polys += polys;
+        n->coords += coords;
+
+        c = next;
+    }
+}
+
+// Carve the tile arrays, widest element first so every array stays aligned.
+// Coords go last, sized for every node, so what simplifying saves can be
+// given back.
+static int alloc_tile(map_tile_t * t, arena_t * arena, const way_counts * n) {
+    if(n->blocks > UINT16_MAX || n->polys >= UINT16_MAX || n->tags > UINT16_MAX || n->strings >= UINT16_MAX) return 1;
+
+    t->poly_coord = arena_malloc(arena, sizeof(uint32_t)*(n->polys+1));
+    t->label_off = arena_malloc(arena, sizeof(way_coord)*n->ways);
+    t->block_box = arena_malloc(arena, sizeof(way_box)*n->blocks);
+    t->way_block = arena_malloc(arena, sizeof(uint16_t)*(n->ways+1));
+    t->block_poly = arena_malloc(arena, sizeof(uint16_t)*(n->blocks+1));
+    t->tag_start = arena_malloc(arena, sizeof(uint16_t)*(n->ways+1));
+    t->tags = arena_malloc(arena, sizeof(uint16_t)*n->tags);
+    t->draw_order = arena_malloc(arena, sizeof(uint16_t)*n->ways);
+    t->subtile_bitmap = arena_malloc(arena, sizeof(uint16_t)*n->ways);
+    t->name = arena_malloc(arena, sizeof(uint16_t)*n->ways);
+    t->house = arena_malloc(arena, sizeof(uint16_t)*n->ways);
+    t->reference = arena_malloc(arena, sizeof(uint16_t)*n->ways);
+    t->osm_layer = arena_malloc(arena, sizeof(uint8_t)*n->ways);
+    t->flags = arena_malloc(arena, sizeof(uint8_t)*n->ways);
+    t->style = arena_malloc(arena, sizeof(uint8_t)*n->ways);
+    t->strings = arena_malloc(arena, sizeof(char)*(n->strings+1));
+    arena_align(arena, sizeof(way_coord));
+    t->coords = arena_malloc(arena, sizeof(way_coord)*n->coords);
+
+    if(t->poly_coord == NULL || t->coords == NULL || t->label_off == NULL || t->block_box == NULL || t->way_block == NULL || \
+       t->block_poly == NULL || t->tag_start == NULL || t->tags == NULL || t->draw_order == NULL || t->subtile_bitmap == NULL || \
+       t->name == NULL || t->house == NULL || t->reference == NULL || t->osm_layer == NULL || \
+       t->flags == NULL || t->style == NULL || t->strings == NULL) return 1;
+
+    return 0;
+}
+
+// Counting sort of the styled ways on layer then priority, done once per
+// decode so drawing a frame is a walk over draw_order.
+static void sort_ways(map_tile_t * t, const style_table_t * stt) {
+    uint16_t start[TILE_LAYERS*(STYLE_MAX_PRIORITY+1)+1];
+    memset(start, 0, sizeof(start));
+
+    for(uint16_t w = 0; w < t->n_ways; w++) {
+        if(t->style[w] == STYLE_NONE) continue;
+        start[t->osm_layer[w]*(STYLE_MAX_PRIORITY+1) + stt->style[t->style[w]].priority + 1]++;
+    }
+
+    for(int k = 1; k < TILE_LAYERS*(STYLE_MAX_PRIORITY+1)+1; k++) start[k] += start[k-1];
+
+    for(int l = 0; l <= TILE_LAYERS; l++) t->layer_start[l] = start[l*(STYLE_MAX_PRIORITY+1)];
+
+    for(uint16_t w = 0; w < t->n_ways; w++) {
+        if(t->style[w] == STYLE_NONE) continue;
+        t->draw_order[start[t->osm_layer[w]*(STYLE_MAX_PRIORITY+1) + stt->style[t->style[w]].priority]++] = w;
+    }
+}
+
+static inline int64_t coord_dist2(way_coord a, way_coord b) {
+    int64_t dx = a.x-b.x;
+    int64_t dy = a.y-b.y;
+    return dx*dx+dy*dy;
+}
+
+// Thin n nodes in place to within tol pixels, keeping both ends. Nodes
+// within tol of the last one kept go first (radial distance), then
+// Douglas-Peucker drops those within tol of the segment between the nodes
+// kept either side, so no node ends up more than 2*tol off the line. A
+// ring is split at the node furthest from its start so it keeps some
+// area. Returns how many nodes are left.
+static uint32_t simplify(way_coord * p, uint32_t n, uint8_t tol) {
+    int64_t tol2 = (int64_t)tol*tol;
+
+    if(tol == 0 || n < 3) return n;
+
+    uint32_t k = 1;
+    for(uint32_t i = 1; i < n-1; i++) {
+        if(coord_dist2(p[i], p[k-1]) > tol2) p[k++] = p[i];
+    }
+
+    // The last node stays, in place of a kept one it is close to.
+    if(k > 1 && coord_dist2(p[n-1], p[k-1]) <= tol2) k--;
+    p[k++] = p[n-1];
+    n = k;
+
+    if(n < 3) return n;
+
+    // Ends of the spans still to check, nearest on top. Nodes are written
+    // back at k, never past the span being checked.
+    uint32_t stack[WAY_SIMPLIFY_DEPTH];
+    int top = 0;
+    stack[top++] = n-1;
+
+    if(p[0].x == p[n-1].x && p[0].y == p[n-1].y) {
+        uint32_t f = 1;
+        for(uint32_t i = 2; i < n-1; i++) {
+            if(coord_dist2(p[i], p[0]) > coord_dist2(p[f], p[0])) f = i;
+        }
+        stack[top++] = f;
+    }
+
+    uint32_t anchor = 0;
+    way_coord a = p[0];
+    k = 1;
+
+    while(top > 0) {
+        uint32_t last = stack[top-1];
+        way_coord b = p[last];
+        int32_t dx = b.x-a.x;
+        int32_t dy = b.y-a.y;
+
+        // Furthest node from the segment a-b. Nodes past either end are
+        // measured to that end and split at first, the rest by how far
+        // they sit off the line.
+        int64_t len2 = (int64_t)dx*dx+(int64_t)dy*dy;
+        uint32_t far = 0, past = 0;
+        int64_t far_d = 0, past_d = 0;
+        for(uint32_t i = anchor+1; i < last; i++) {
+            int64_t ex = p[i].x-a.x;
+            int64_t ey = p[i].y-a.y;
+            int64_t along = ex*dx+ey*dy;
+
+            if(along <= 0 || along >= len2) {
+                int64_t d = coord_dist2(p[i], (along <= 0) ? a : b);
+                if(d > past_d) {
+                    past_d = d;
+                    past = i;
                 }
-            } else { // Double Delta
+            } else {
+                int64_t d = dx*ey-dy*ex;
+                if(d < 0) d = -d;
+                if(d > far_d) {
+                    far_d = d;
+                    far = i;
+                }
+            }
+        }
+
+        int split = 0;
+        if(past_d > tol2) {
+            far = past;
+            split = 1;
+        } else if(far) {
+            split = (double)far_d*far_d > (double)tol2*len2;
+        }
+
+        if(split && top < WAY_SIMPLIFY_DEPTH) {
+            stack[top++] = far;
+            continue;
+        }
+
+        // Too deep to split further, the span is kept whole.
+        if(split) {
+            for(uint32_t i = anchor+1; i < last; i++) p[k++] = p[i];
+        }
+
+        p[k++] = b;
+        anchor = last;
+        a = b;
+        top--;
+    }
+
+    return k;
+}
+
+// Bounds of coords c0 up to c1, empty if there are none.
+static way_box coord_box(const way_coord * coords, uint32_t c0, uint32_t c1) {
+    way_box b = { INT16_MAX, INT16_MAX, INT16_MIN, INT16_MIN };
+
+    for(uint32_t i = c0; i < c1; i++) {
+        if(coords[i].x < b.x0) b.x0 = coords[i].x;
+        if(coords[i].x > b.x1) b.x1 = coords[i].x;
+        if(coords[i].y < b.y0) b.y0 = coords[i].y;
+        if(coords[i].y > b.y1) b.y1 = coords[i].y;
+    }
+
+    return b;
+}
+
+// Whether two boxes share a pixel.
+static inline int box_overlap(const way_box * a, const way_box * b) {
+    return a->x0 <= b->x1 && b->x0 <= a->x1 && a->y0 <= b->y1 && b->y0 <= a->y1;
+}
+
+// Bucket every way into the grid cells its box covers, counted first so
+// the lists are carved to size. Leaves the tile without a grid if the
+// arena hasn't room for it.
+static void build_grid(map_tile_t * t, arena_t * arena) {
+    uint32_t start[TILE_GRID*TILE_GRID+1];
+    memset(start, 0, sizeof(start));
+
+    // Smallest power of two cell spreading the tile's box over the grid.
+    int32_t extent = t->box.x1 - t->box.x0;
+    if(t->box.y1 - t->box.y0 > extent) extent = t->box.y1 - t->box.y0;
+    t->grid_shift = 0;
+    while((TILE_GRID << t->grid_shift) <= extent) t->grid_shift++;
+
+    for(uint16_t w = 0; w < t->n_ways; w++) {
+        way_box b = tile_way_box(t, w);
+        if(b.x0 > b.x1) continue;
+
+        for(int cy = tile_grid_cell(t, b.y0, t->box.y0); cy <= tile_grid_cell(t, b.y1, t->box.y0); cy++) {
+            for(int cx = tile_grid_cell(t, b.x0, t->box.x0); cx <= tile_grid_cell(t, b.x1, t->box.x0); cx++) {
+                start[cy*TILE_GRID+cx+1]++;
+            }
+        }
+    }
+
+    for(int k = 1; k < TILE_GRID*TILE_GRID+1; k++) start[k] += start[k-1];
+
+    uint32_t n = start[TILE_GRID*TILE_GRID];
+    arena_align(arena, sizeof(uint32_t));
+    if(arena_left(arena) < sizeof(start) + sizeof(uint16_t)*n + (t->n_ways+7)/8) return;
+
+    t->grid_start = arena_malloc(arena, sizeof(start));
+    t->grid_ways = arena_malloc(arena, sizeof(uint16_t)*n);
+    t->grid_mark = arena_malloc(arena, (t->n_ways+7)/8);
+    memcpy(t->grid_start, start, sizeof(start));
+
+    // Second pass with start as each cell's write position, leaving every
+    // list in way order.
+    for(uint16_t w = 0; w < t->n_ways; w++) {
+        way_box b = tile_way_box(t, w);
+        if(b.x0 > b.x1) continue;
+
+        for(int cy = tile_grid_cell(t, b.y0, t->box.y0); cy <= tile_grid_cell(t, b.y1, t->box.y0); cy++) {
+            for(int cx = tile_grid_cell(t, b.x0, t->box.x0); cx <= tile_grid_cell(t, b.x1, t->box.x0); cx++) {
+                t->grid_ways[start[cy*TILE_GRID+cx]++] = w;
+            }
+        }
+    }
+}
+
+// Ways whose box touches b, each once, from the cells b covers. A way in
+// several of them is only taken from the first, where its box and b both
+// start. Writes up to max ways to out and returns how many it wrote.
+uint16_t tile_grid_query(const map_tile_t * t, const way_box * b, uint16_t * out, uint16_t max) {
+    uint16_t n = 0;
+
+    if(!box_overlap(b, &t->box)) return 0;
+
+    if(t->grid_start == NULL) {
+        for(uint16_t w = 0; w < t->n_ways && n < max; w++) {
+            way_box wb = tile_way_box(t, w);
+            if(box_overlap(b, &wb)) out[n++] = w;
+        }
+        return n;
+    }
+
+    int cx0 = tile_grid_cell(t, b->x0, t->box.x0);
+    int cy0 = tile_grid_cell(t, b->y0, t->box.y0);
+    int cx1 = tile_grid_cell(t, b->x1, t->box.x0);
+    int cy1 = tile_grid_cell(t, b->y1, t->box.y0);
+
+    for(int cy = cy0; cy <= cy1; cy++) {
+        for(int cx = cx0; cx <= cx1; cx++) {
+            for(uint32_t i = t->grid_start[cy*TILE_GRID+cx]; i < t->grid_start[cy*TILE_GRID+cx+1]; i++) {
+                uint16_t w = t->grid_ways[i];
+                way_box wb = tile_way_box(t, w);
+                if(!box_overlap(b, &wb)) continue;
+
+                int wx = tile_grid_cell(t, wb.x0, t->box.x0);
+                int wy = tile_grid_cell(t, wb.y0, t->box.y0);
+                if(cx != (wx > cx0 ? wx : cx0) || cy != (wy > cy0 ? wy : cy0)) continue;
+
+                if(n == max) return n;
+                out[n++] = w;
+            }
+        }
+    }
+
+    return n;
+}
+
+// Returns 0 on success, 2 if some ways are truncated (t keeps every way
+// that decoded whole) and 3 if the tile doesn't fit in the arena.
+// Rings are thinned to within tol pixels, the nodes dropped given back to
+// the arena.
+int decode_ways(map_tile_t * t, cursor_t * c, arena_t * arena, uint16_t n_ways, uint16_t st, const way_filter_t * wf, const style_table_t * stt, const proj_t * pj, uint8_t tol) {
+    way_counts n;
+    count_ways(*c, n_ways, st, wf, &n);
+
+    memset(t, 0, sizeof(map_tile_t));
+    if(alloc_tile(t, arena, &n)) return 3;
+
+    uint16_t w = 0;
+    uint16_t bi = 0;
+    uint16_t pi = 0;
+    uint32_t ci = 0;
+    uint16_t ti = 0;
+    uint16_t si = 1;
+    int bad = 0;
+
+    t->strings[0] = '\0';
+
+    for(int in = 0; in < n.ways_in; in++) {
+        cursor_t next;
+        uint16_t subtile;
+        uint8_t special;
+        uint32_t tags[15];
+
+        if(way_head(c, &next, st, wf, &subtile, &special, tags)) continue;
+
+        // Where this way's entries start, to drop it whole if it reads short.
+        uint16_t bi0 = bi;
+        uint16_t pi0 = pi;
+        uint32_t ci0 = ci;
+        uint16_t ti0 = ti;
+        uint16_t si0 = si;
+
+        t->subtile_bitmap[w] = subtile;
+        t->osm_layer[w] = (special & 0xf0) >> 4;
+
+        // First tag with a style decides how the way is drawn.
+        t->style[w] = STYLE_NONE;
+        t->tag_start[w] = ti;
+        for(int tag = 0; tag < (special & 0x0f); tag++) {
+            t->tags[ti++] = tags[tag];
+            if(t->style[w] == STYLE_NONE) t->style[w] = style_lookup(stt, tags[tag]);
+        }
+
+        uint8_t flags = get_uint8(c);
+        t->flags[w] = flags;
+
+        uint16_t * str[3] = { &t->name[w], &t->house[w], &t->reference[w] };
+        for(int s = 0; s < 3; s++) {
+            *str[s] = 0;
+            if(flags & (0x80 >> s)) { // Name, house number, reference
+                uint8_t len = get_uint8(c);
+                *str[s] = si;
+                get_string(c, t->strings + si, len);
+                si += len + 1;
+            }
+        }
+
+        t->label_off[w].x = 0;
+        t->label_off[w].y = 0;
+        if(flags & 0x10) { // Label Position
+            t->label_off[w].y = get_vbe_int(c);
+            t->label_off[w].x = get_vbe_int(c);
+        }
+
+        uint32_t blocks = (flags & 0x08) ? get_vbe_uint(c) : 1;
+
+        t->way_block[w] = bi;
+
+        // Sized by the counting pass, the checks below only catch data that
+        // reads differently the second time round.
+
+        for(uint32_t wdb = 0; wdb < blocks; wdb++) {
+            uint32_t polys = get_vbe_uint(c);
+
+            if(bi == n.blocks || polys > n.polys - pi) c->error = 1;
+            if(c->error) break;
+
+            t->block_poly[bi++] = pi;
+
+            for(uint32_t wcb = 0; wcb < polys; wcb++) {
+                uint32_t nodes = get_vbe_uint(c);
+
+                if(nodes > n.coords - ci) c->error = 1;
+                if(c->error) break;
+
+                t->poly_coord[pi++] = ci;
+
+                if(nodes == 0) continue;
+
+                way_coord * coords = t->coords + ci;
+
+                // Get Origin
+                int32_t lat = get_vbe_int(c) + pj->lat_off;
+                int32_t lon = get_vbe_int(c) + pj->lon_off;
+
+                coords[0].y = PROJ_LAT(pj, lat);
+                coords[0].x = proj_lon(pj, lon);
+
+                // Loop Coordinates, deltas come in as runs of lat/lon pairs
+                int32_t run[2*WAY_RUN_NODES];
                 int32_t d_lon = 0;
                 int32_t d_lat = 0;
-                pd_lat = 0;
-                pd_lon = 0;
-                //printf("DD ");
-                for(int wc = 1; wc < wp->data[wdb].block[wcb].nodes; wc++) {
-                    d_lat = pd_lat + get_vbe_int(fbh);
-                    d_lon = pd_lon + get_vbe_int(fbh);
-
-                    lat += d_lat;                    
-                    lon += d_lon;
-
-                    pd_lat = d_lat;
-                    pd_lon = d_lon;
-                    
-                    wp->data[wdb].block[wcb].coords[wc].y = -lat_to_y(lat, scale);
-                    wp->data[wdb].block[wcb].coords[wc].x = lon_to_x(lon, scale*x_mercator);
-                    
-                    //printf("%d ", wp->data[wdb].block[wcb].coords[wc][0]);
-                    //printf("%d ", wp->data[wdb].block[wcb].coords[wc][1]);
+
+                for(uint32_t wc = 1; wc < nodes; wc += WAY_RUN_NODES) {
+                    uint32_t r_n = nodes - wc;
+                    if(r_n > WAY_RUN_NODES) r_n = WAY_RUN_NODES;
+
+                    if(decode_vbe_int_run(c, run, 2*r_n) != 2*r_n) break;
+
+                    if(!(flags & 0x04)) { // Single Delta
+                        for(uint32_t r = 0; r < r_n; r++) {
+                            lat += run[2*r];
+                            lon += run[2*r+1];
+                            coords[wc+r].y = PROJ_LAT(pj, lat);
+                            coords[wc+r].x = proj_lon(pj, lon);
+                        }
+                    } else { // Double Delta
+                        for(uint32_t r = 0; r < r_n; r++) {
+                            d_lat += run[2*r];
+                            d_lon += run[2*r+1];
+
+                            lat += d_lat;
+                            lon += d_lon;
+
+                            coords[wc+r].y = PROJ_LAT(pj, lat);
+                            coords[wc+r].x = proj_lon(pj, lon);
+                        }
+                    }
                 }
+
+                // A ring cut short is garbage past where it stopped.
+                if(c->error) break;
+
+                ci += simplify(coords, nodes, tol);
             }
         }
-        //printf("Block\n");
+
+        // The counting pass doesn't read the last ring, so this trips on a
+        // way whose coordinates are shorter than its node counts claim. The
+        // way is left out and the next one read from its size prefix.
+        if(c->error) {
+            bi = bi0;
+            pi = pi0;
+            ci = ci0;
+            ti = ti0;
+            si = si0;
+            bad = 1;
+            if(next.error) break;
+            *c = next;
+            continue;
+        }
+
+        w++;
+        *c = next;
+    }
+
+    t->n_ways = w;
+    t->n_blocks = bi;
+    t->n_polys = pi;
+    t->n_coords = ci;
+
+    t->way_block[w] = bi;
+    t->block_poly[bi] = pi;
+    t->poly_coord[pi] = ci;
+    t->tag_start[w] = ti;
+
+    arena_shrink(arena, sizeof(way_coord)*(n.coords-ci));
+
+    // Blocks own consecutive rings, so each box is one run over its coords.
+    t->box = coord_box(t->coords, 0, 0);
+    for(uint16_t b = 0; b < bi; b++) {
+        way_box * bb = &t->block_box[b];
+        *bb = coord_box(t->coords, t->poly_coord[t->block_poly[b]], t->poly_coord[t->block_poly[b+1]]);
+        if(bb->x0 > bb->x1) continue;
+
+        if(bb->x0 < t->box.x0) t->box.x0 = bb->x0;
+        if(bb->y0 < t->box.y0) t->box.y0 = bb->y0;
+        if(bb->x1 > t->box.x1) t->box.x1 = bb->x1;
+        if(bb->y1 > t->box.y1) t->box.y1 = bb->y1;
     }
-    //printf("\n");
 
-    return 0; // No advance needed
+    build_grid(t, arena);
+    sort_ways(t, stt);
+
+    if(bad || n.ways_in < n_ways) return 2;
+
+    return 0;
 }
 
 int32_t lon_to_x(int32_t lon, float scale) {
@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "bitmap.h"
+#include "prof.h"
+
+// Times bitmap_affine_blit() turning an offscreen render larger than the
+// display onto a display sized bitmap, as a rotating map view would each
+// frame. Nearest sampling is checked against a reference which works out
+// every pixel's source position from the matrix on its own, and counts
+// the pixels where the two differ.
+
+#define SRC_SIZE 184 // Covers the display's diagonal at any angle
+#define DST_SIZE 130
+#define N_ANGLES 64
+
+static uint8_t src_buffer[SRC_SIZE*SRC_SIZE*2];
+static uint8_t dst_buffer[DST_SIZE*DST_SIZE*2];
+static uint8_t ref_buffer[DST_SIZE*DST_SIZE*2];
+
+static void reference_blit(const bitmap_affine_t * m, bitmap_t * src, bitmap_t * dst) {
+    uint8_t bytes = dst->depth/8;
+
+    for(int32_t y = 0; y < dst->height; y++) {
+        for(int32_t x = 0; x < dst->width; x++) {
+            int64_t u = m->c + (m->a + (int64_t)m->b*(2*y+1))/2 + (int64_t)m->a*x;
+            int64_t v = m->f + (m->d + (int64_t)m->e*(2*y+1))/2 + (int64_t)m->d*x;
+
+            if(u < 0 || v < 0 || u >= (int64_t)src->width << 16 || v >= (int64_t)src->height << 16) continue;
+
+            memcpy(dst->buffer + dst->pitch*y + bytes*x, src->buffer + src->pitch*(v >> 16) + bytes*(u >> 16), bytes);
+        }
+    }
+}
+
+int main(int argc, char ** argv) {
+    int iterations = (argc > 1) ? atoi(argv[1]) : 20;
+    static const uint8_t depths[] = {8, 16};
+
+    for(size_t i = 0; i < sizeof(src_buffer); i++) src_buffer[i] = rand();
+
+    printf("%-6s %-9s %12s %10s %12s %8s %8s\n", "depth", "sample", "us/frame", "ns/pixel", "reference us", "speedup", "diff");
+
+    for(size_t d = 0; d < sizeof(depths); d++) {
+        bitmap_t src = { .width = SRC_SIZE, .height = SRC_SIZE, .depth = depths[d] };
+        bitmap_t dst = { .width = DST_SIZE, .height = DST_SIZE, .depth = depths[d] };
+        bitmap_t ref = dst;
+        bitmap_init(&src, src_buffer);
+        bitmap_init(&dst, dst_buffer);
+        bitmap_init(&ref, ref_buffer);
+
+        for(uint8_t sample = BITMAP_SAMPLE_NEAREST; sample <= BITMAP_SAMPLE_BILINEAR; sample++) {
+            uint64_t blit_us = 0;
+            uint64_t reference_us = 0;
+            uint64_t diff = 0;
+
+            for(int it = 0; it < iterations; it++) {
+                for(int a = 0; a < N_ANGLES; a++) {
+                    bitmap_affine_t m;
+                    float angle = 2*(float)M_PI*a/N_ANGLES;
+                    // Zoom slightly past 1:1 now and then to cover scaling too.
+                    float scale = (a & 1) ? 1.0f : 1.25f;
+                    bitmap_affine_rotate(&m, angle, scale, SRC_SIZE/2.0f, SRC_SIZE/2.0f, DST_SIZE/2.0f, DST_SIZE/2.0f);
+
+                    // Pixels landing outside the source are left alone.
+                    memset(dst_buffer, 0, sizeof(dst_buffer));
+                    memset(ref_buffer, 0, sizeof(ref_buffer));
+
+                    uint64_t t0 = prof_time_us();
+                    bitmap_affine_blit(&m, sample, &src, &dst);
+                    blit_us += prof_time_us() - t0;
+
+                    if(sample == BITMAP_SAMPLE_NEAREST) {
+                        t0 = prof_time_us();
+                        reference_blit(&m, &src, &ref);
+                        reference_us += prof_time_us() - t0;
+
+                        if(it == 0) {
+                            for(size_t p = 0; p < dst.size; p++) diff += dst_buffer[p] != ref_buffer[p];
+                        }
+                    }
+                }
+            }
+
+            double frames = (double)N_ANGLES*iterations;
+            const char * name = (sample == BITMAP_SAMPLE_NEAREST) ? "nearest" : "bilinear";
+            if(sample == BITMAP_SAMPLE_NEAREST) {
+                printf("%-6d %-9s %12.2f %10.2f %12.2f %7.2fx %8llu\n", depths[d], name, blit_us/frames,
+                    1000.0*blit_us/frames/(DST_SIZE*DST_SIZE), reference_us/frames, (double)reference_us/blit_us,
+                    (unsigned long long)diff);
+            } else {
+                printf("%-6d %-9s %12.2f %10.2f %12s %8s %8s\n", depths[d], name, blit_us/frames,
+                    1000.0*blit_us/frames/(DST_SIZE*DST_SIZE), "-", "-", "-");
+            }
+        }
+    }
+
+    return 0;
+}
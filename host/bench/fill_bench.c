@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "hagl.h"
+#include "prof.h"
+
+// Compares hagl_fill_polygon() against the active edge table filler
+// hagl_fill_rings() on random polygons over the display, counting the
+// pixels where their output differs.
+
+#define N_POLYGONS 256
+#define MAX_VERTICES 1024
+
+extern uint8_t buffer1[DISPLAY_WIDTH*DISPLAY_HEIGHT];
+
+typedef struct {
+    const char * name;
+    int vertices;
+    float radius; // Of the display's half width
+    float jitter; // Share of the radius each vertex moves in by
+    int star; // Alternate vertices pulled in to half the radius
+} shape_t;
+
+static const shape_t shapes[] = {
+    { "triangle",     3, 0.6f, 0.0f, 0 },
+    { "building",     8, 0.3f, 0.3f, 0 },
+    { "area",        40, 0.8f, 0.3f, 0 },
+    { "star",        64, 1.2f, 0.0f, 1 },
+    { "large area", 1000, 1.5f, 0.1f, 0 },
+};
+
+static int16_t vertices[N_POLYGONS][MAX_VERTICES*2];
+static hagl_edge_t edges[MAX_VERTICES];
+static uint8_t reference[DISPLAY_WIDTH*DISPLAY_HEIGHT];
+
+static void make_polygon(const shape_t * s, int16_t * v) {
+    float cx = rand() % DISPLAY_WIDTH;
+    float cy = rand() % DISPLAY_HEIGHT;
+    float r = s->radius*DISPLAY_WIDTH/2;
+    float a0 = (rand() % 1000)*0.00628f;
+
+    for(int i = 0; i < s->vertices; i++) {
+        float k = 1.0f - s->jitter*(rand() % 1000)/1000.0f;
+        if(s->star && (i & 1)) k *= 0.5f;
+
+        float a = a0 + 2*(float)M_PI*i/s->vertices;
+        v[i*2] = lroundf(cx + r*k*cosf(a));
+        v[i*2+1] = lroundf(cy + r*k*sinf(a));
+    }
+}
+
+static uint64_t count_pixels(const uint8_t * a, const uint8_t * b, uint64_t * filled) {
+    uint64_t diff = 0;
+
+    for(int i = 0; i < DISPLAY_WIDTH*DISPLAY_HEIGHT; i++) {
+        if(a[i] != b[i]) diff++;
+        if(b[i]) (*filled)++;
+    }
+
+    return diff;
+}
+
+int main(int argc, char ** argv) {
+    int iterations = (argc > 1) ? atoi(argv[1]) : 20;
+
+    hagl_init();
+
+    printf("%-12s %8s %12s %12s %8s %8s\n", "polygon", "vertices", "polygon us", "rings us", "speedup", "diff %");
+
+    for(size_t s = 0; s < sizeof(shapes)/sizeof(shapes[0]); s++) {
+        const shape_t * sh = &shapes[s];
+        // The old filler keeps 64 crossings per row and counts vertices
+        // in 8 bits while finding its rows, so larger polygons only run
+        // through the new one.
+        int compare = sh->vertices <= 64;
+        uint16_t end = sh->vertices;
+
+        srand(1);
+        for(int p = 0; p < N_POLYGONS; p++) {
+            make_polygon(sh, vertices[p]);
+        }
+
+        uint64_t polygon_us = 0;
+        uint64_t rings_us = 0;
+        uint64_t diff = 0;
+        uint64_t filled = 0;
+
+        for(int it = 0; it < iterations; it++) {
+            for(int p = 0; p < N_POLYGONS; p++) {
+                uint64_t t0;
+
+                if(compare) {
+                    memset(buffer1, 0, sizeof(buffer1));
+                    t0 = prof_time_us();
+                    hagl_fill_polygon(sh->vertices, vertices[p], 0xff);
+                    polygon_us += prof_time_us() - t0;
+                    memcpy(reference, buffer1, sizeof(buffer1));
+                }
+
+                memset(buffer1, 0, sizeof(buffer1));
+                t0 = prof_time_us();
+                hagl_fill_rings(1, &end, vertices[p], edges, 0xff);
+                rings_us += prof_time_us() - t0;
+
+                if(compare && it == 0) diff += count_pixels(reference, buffer1, &filled);
+            }
+        }
+
+        double total = (double)N_POLYGONS*iterations;
+        if(compare) {
+            printf("%-12s %8d %12.2f %12.2f %7.2fx %7.2f%%\n", sh->name, sh->vertices, polygon_us/total,
+                rings_us/total, (double)polygon_us/rings_us, filled ? 100.0*diff/filled : 0.0);
+        } else {
+            printf("%-12s %8d %12s %12.2f %8s %8s\n", sh->name, sh->vertices, "-", rings_us/total, "-", "-");
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,357 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "hagl.h"
+#include "hagl_hal.h"
+#include "map.h"
+#include "memory.h"
+#include "prof.h"
+#include "tile_cache.h"
+#include "viewport.h"
+#include "prefetch.h"
+
+static const char * stage_names[PROF_N_STAGES] = {
+    "header parse",
+    "tile lookup",
+    "way decode",
+    "rasterise",
+};
+
+static void usage(const char * argv0) {
+    fprintf(stderr, "Usage: %s [-n iterations] [-c cache slots] [-s size] [-r rot] [-S tol] [-P] [-g] [-t key=value,...] [-T theme.txt] [-o out.ppm] <file.map> <zoom> <x,y> [x,y ...]\n", argv0);
+    fprintf(stderr, "       %s -p [-f] [options] <file.map> <zoom> <lat,lon> [lat,lon ...]\n", argv0);
+    fprintf(stderr, "  -p  render viewports centred on each position\n");
+    fprintf(stderr, "  -f  prefetch ahead of the path on a worker thread, paced at 15 fps\n");
+    fprintf(stderr, "  -t  only decode ways with one of these tags\n");
+    fprintf(stderr, "  -T  style ways from a theme file instead of the built in rules\n");
+    fprintf(stderr, "  -P  decode and draw POIs\n");
+    fprintf(stderr, "  -S  pixels ways are simplified to, 0 keeps every node (default 1)\n");
+    fprintf(stderr, "  -g  check the grid marks and queries against a linear scan of way boxes\n");
+}
+
+// Ways a linear scan over their block boxes finds on screen but the grid
+// left unmarked, so they would wrongly go undrawn.
+static uint32_t grid_misses(const map_tile_t * tile, const map_view_t * v, int16_t margin) {
+    uint32_t missed = 0;
+
+    for(uint16_t w = 0; w < tile->n_ways; w++) {
+        int seen = 0;
+        for(uint16_t b = tile->way_block[w]; b < tile->way_block[w+1] && !seen; b++) {
+            seen = map_view_box_visible(v, &tile->block_box[b], margin);
+        }
+        if(seen && !(tile->grid_mark[w >> 3] & (1 << (w & 7)))) missed++;
+    }
+    return missed;
+}
+
+#define GRID_QUERY_BOXES 64
+
+// Ways tile_grid_query() gets wrong over the whole tile and boxes scattered
+// across it, next to a linear scan of every way's box: missed, returned
+// twice or returned without touching the query.
+static uint32_t grid_query_misses(const map_tile_t * tile, uint32_t * queries) {
+    static uint16_t out[UINT16_MAX];
+    static uint8_t found[UINT16_MAX];
+    uint32_t missed = 0;
+    uint32_t seed = tile->n_ways;
+
+    int32_t w0 = tile->box.x1 - tile->box.x0 + 1;
+    int32_t h0 = tile->box.y1 - tile->box.y0 + 1;
+
+    for(int q = 0; q <= GRID_QUERY_BOXES; q++) {
+        way_box b = tile->box;
+        if(q > 0) {
+            seed = seed*1103515245 + 12345;
+            int32_t x = tile->box.x0 + (int32_t)((seed >> 8) % w0);
+            int32_t bw = (int32_t)((seed >> 4) % ((w0 >> (q & 3)) + 1));
+            seed = seed*1103515245 + 12345;
+            int32_t y = tile->box.y0 + (int32_t)((seed >> 8) % h0);
+            int32_t bh = (int32_t)((seed >> 4) % ((h0 >> (q & 3)) + 1));
+            b.x0 = x;
+            b.y0 = y;
+            b.x1 = x + bw > INT16_MAX ? INT16_MAX : x + bw;
+            b.y1 = y + bh > INT16_MAX ? INT16_MAX : y + bh;
+        }
+
+        uint16_t n = tile_grid_query(tile, &b, out, tile->n_ways);
+        memset(found, 0, tile->n_ways);
+        for(uint16_t i = 0; i < n; i++) {
+            if(found[out[i]]++) missed++;
+        }
+
+        for(uint16_t w = 0; w < tile->n_ways; w++) {
+            way_box wb = tile_way_box(tile, w);
+            int hit = b.x0 <= wb.x1 && wb.x0 <= b.x1 && b.y0 <= wb.y1 && wb.y0 <= b.y1;
+            if(hit != (found[w] != 0)) missed++;
+        }
+        (*queries)++;
+    }
+    return missed;
+}
+
+// Expand the 8-bit framebuffer to a binary PPM for eyeballing output.
+static void write_ppm(const char * filename, bitmap_t * bb) {
+    FILE * fp = fopen(filename, "wb");
+    if(fp == NULL) {
+        fprintf(stderr, "Couldn't open %s\n", filename);
+        return;
+    }
+
+    fprintf(fp, "P6\n%d %d\n255\n", bb->width, bb->height);
+    for(uint32_t i = 0; i < (uint32_t)bb->width*bb->height; i++) {
+        uint8_t c = bb->buffer[i];
+        uint8_t rgb[3] = {
+            (uint8_t)((c >> 5) * 255 / 7),
+            (uint8_t)(((c >> 2) & 0x07) * 255 / 7),
+            (uint8_t)((c & 0x03) * 255 / 3),
+        };
+        fwrite(rgb, 1, 3, fp);
+    }
+    fclose(fp);
+}
+
+int main(int argc, char ** argv) {
+    int iterations = 10;
+    int cache_slots = 0;
+    float size = 128;
+    float rot = 0;
+    const char * out = NULL;
+    int positions = 0;
+    int prefetch = 0;
+    int pois = 0;
+    int simplify = 1;
+    int grid_check = 0;
+    uint32_t grid_checked = 0;
+    uint32_t grid_missed = 0;
+    uint32_t grid_queries = 0;
+    uint32_t grid_query_missed = 0;
+    char * tags = NULL;
+    const char * theme_file = NULL;
+
+    int arg = 1;
+    while(arg < argc && argv[arg][0] == '-') {
+        if(argv[arg][1] == 'p' || argv[arg][1] == 'f' || argv[arg][1] == 'P' || argv[arg][1] == 'g') {
+            if(argv[arg][1] == 'p') positions = 1;
+            else if(argv[arg][1] == 'P') pois = 1;
+            else if(argv[arg][1] == 'g') grid_check = 1;
+            else prefetch = 1;
+            arg++;
+            continue;
+        }
+        if(arg + 1 >= argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        switch(argv[arg][1]) {
+            case 'n': iterations = atoi(argv[arg+1]); break;
+            case 'c': cache_slots = atoi(argv[arg+1]); break;
+            case 's': size = atof(argv[arg+1]); break;
+            case 'r': rot = atof(argv[arg+1]); break;
+            case 'o': out = argv[arg+1]; break;
+            case 't': tags = argv[arg+1]; break;
+            case 'T': theme_file = argv[arg+1]; break;
+            case 'S': simplify = atoi(argv[arg+1]); break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+        arg += 2;
+    }
+
+    if(argc - arg < 3) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    char * filename = argv[arg++];
+    uint32_t zoom = atoi(argv[arg++]);
+    int n_tiles = argc - arg;
+    uint32_t * tiles = malloc(sizeof(uint32_t)*2*n_tiles);
+    int32_t * centres = malloc(sizeof(int32_t)*2*n_tiles);
+
+    for(int t = 0; t < n_tiles; t++) {
+        if(positions) {
+            double lat, lon;
+            if(sscanf(argv[arg+t], "%lf,%lf", &lat, &lon) != 2) {
+                fprintf(stderr, "Bad position '%s', expected lat,lon\n", argv[arg+t]);
+                return 1;
+            }
+            centres[2*t] = lat*1000000;
+            centres[2*t+1] = lon*1000000;
+        } else if(sscanf(argv[arg+t], "%u,%u", &tiles[2*t], &tiles[2*t+1]) != 2) {
+            fprintf(stderr, "Bad tile '%s', expected x,y\n", argv[arg+t]);
+            return 1;
+        }
+    }
+
+    // Viewports need every visible tile resident at once.
+    if(positions && cache_slots == 0) cache_slots = 9;
+
+    bitmap_t * bb = hagl_init();
+
+    static uint8_t a0_buffer[ARENA_DEFAULT_SIZE];
+    arena_t a0;
+    arena_init_buffer(&a0, a0_buffer, sizeof(a0_buffer));
+
+    uint32_t total_ways = 0;
+    size_t peak_arena = 0;
+
+    prof_reset();
+
+    static map_handle_t mh;
+    if(open_map(&mh, filename)) {
+        fprintf(stderr, "Failed to open %s\n", filename);
+        return 1;
+    }
+
+    static way_filter_t wf;
+    if(tags) {
+        const char * names[64];
+        int n_names = 0;
+        for(char * tok = strtok(tags, ","); tok && n_names < 64; tok = strtok(NULL, ",")) {
+            names[n_names++] = tok;
+        }
+        if(map_filter_init(&wf, &mh.hdr.way_tags, names, n_names)) {
+            fprintf(stderr, "No matching way tags in %s\n", filename);
+            return 1;
+        }
+        mh.filter = &wf;
+    }
+
+    mh.pois = pois;
+    mh.simplify = simplify;
+
+    static theme_t theme;
+    if(theme_file && (theme_load(&theme, theme_file) || map_set_theme(&mh, &theme))) {
+        fprintf(stderr, "Failed to load theme %s\n", theme_file);
+        return 1;
+    }
+
+    static tile_cache_t tc;
+    if(cache_slots && tile_cache_init(&tc, cache_slots, prefetch ? PREFETCH_BUFFERS : 0, ARENA_DEFAULT_SIZE)) {
+        fprintf(stderr, "Failed to allocate %d cache slots\n", cache_slots);
+        return 1;
+    }
+
+    static prefetcher_t pf;
+    if(prefetch && (!positions || prefetch_start(&pf, filename, &tc, theme_file ? &theme : NULL))) {
+        fprintf(stderr, "Failed to start prefetcher\n");
+        return 1;
+    }
+    if(prefetch) {
+        pf.mh.filter = mh.filter;
+        pf.mh.pois = mh.pois;
+        pf.mh.simplify = mh.simplify;
+    }
+
+    printf("header: %zu bytes, %u poi tags, %u way tags\n", sizeof(mapsforge_file_header),
+        mh.hdr.poi_tags.n_tags, mh.hdr.way_tags.n_tags);
+
+    for(int it = 0; it < iterations; it++) {
+        for(int t = 0; t < n_tiles; t++) {
+            static map_tile_t loaded;
+            const map_tile_t * tile = &loaded;
+
+            int wd;
+
+            if(positions) {
+                static viewport_t vp;
+
+                if(prefetch) prefetch_poll(&pf, &tc);
+
+                viewport_load(&vp, &tc, &mh, centres[2*t], centres[2*t+1], zoom, DISPLAY_WIDTH, DISPLAY_HEIGHT, rot, size);
+
+                if(prefetch) {
+                    int n = (t + 1 < n_tiles) ? t + 1 : t;
+                    int p = (n > 0) ? n - 1 : 0;
+                    float heading = atan2f(centres[2*n+1] - centres[2*p+1], centres[2*n] - centres[2*p]);
+                    prefetch_update(&pf, &tc, &vp, heading);
+                }
+
+                if(it == 0) {
+                    for(int v = 0; v < vp.n_tiles; v++) total_ways += vp.tile[v].tile->n_ways;
+                }
+
+                PROF_START(PROF_RASTER);
+                hagl_clear_screen();
+                viewport_draw(&vp);
+                hagl_flush();
+                PROF_END(PROF_RASTER);
+
+                if(prefetch) usleep(1000000/15);
+                continue;
+            } else if(cache_slots) {
+                wd = tile_cache_get(&tc, &mh, &tile, tiles[2*t], tiles[2*t+1], zoom, 0xFFFF, size);
+            } else {
+                arena_free(&a0);
+                wd = map_load_tile(&mh, &a0, &loaded, tiles[2*t], tiles[2*t+1], zoom, 0xFFFF, size);
+                if(a0.current > peak_arena) peak_arena = a0.current;
+            }
+
+            if(it == 0) total_ways += wd;
+
+            PROF_START(PROF_RASTER);
+            hagl_clear_screen();
+            map_view_t view;
+            map_view_init(&view, rot, DISPLAY_WIDTH, DISPLAY_HEIGHT);
+            int16_t margin = 2*mh.style.max_width+1;
+            if(wd >= 0 && map_view_transform(&view, tile, margin) && grid_check && tile->grid_mark) {
+                grid_checked += tile->n_ways;
+                grid_missed += grid_misses(tile, &view, margin);
+                if(it == 0) grid_query_missed += grid_query_misses(tile, &grid_queries);
+            }
+            for(int l = 0; wd > 0 && l < TILE_LAYERS; l++) {
+                g_draw_layer(tile, &mh.style, l, 1, zoom, &view);
+                g_draw_layer(tile, &mh.style, l, 0, zoom, &view);
+            }
+            if(wd >= 0) {
+                label_set_t labels;
+                labels.n = 0;
+                g_draw_pois(tile, &mh.poi_style, zoom, &view);
+                g_draw_poi_labels(tile, &mh.poi_style, zoom, &view, &labels);
+            }
+            hagl_flush();
+            PROF_END(PROF_RASTER);
+        }
+    }
+
+    printf("%d tiles x %d iterations, %u ways per pass, peak arena %zu/%d bytes\n",
+        n_tiles, iterations, total_ways, peak_arena, ARENA_DEFAULT_SIZE);
+    printf("%-14s %8s %12s %12s\n", "stage", "calls", "total ms", "avg us");
+    for(int s = 0; s < PROF_N_STAGES; s++) {
+        prof_counter * c = &prof_counters[s];
+        printf("%-14s %8u %12.3f %12.1f\n", stage_names[s], c->calls,
+            c->total_us/1000.0, c->calls ? (double)c->total_us/c->calls : 0.0);
+    }
+    printf("ways drawn %u, culled %u, tiles culled %u\n", prof_counts[PROF_WAYS_DRAWN],
+        prof_counts[PROF_WAYS_CULLED], prof_counts[PROF_TILES_CULLED]);
+
+    if(grid_check) {
+        printf("grid check: %u ways checked, %u on screen left unmarked\n", grid_checked, grid_missed);
+        printf("grid query: %u boxes, %u ways differing from a linear scan\n", grid_queries, grid_query_missed);
+    }
+
+    if(prefetch) {
+        printf("prefetch: %u tiles adopted\n", pf.adopted);
+        prefetch_stop(&pf);
+    }
+
+    if(cache_slots) {
+        printf("tile cache: %d slots, %u hits, %u misses\n", cache_slots, tc.hits, tc.misses);
+        tile_cache_free(&tc);
+    }
+
+    close_map(&mh);
+    if(tags) map_filter_free(&wf);
+    if(theme_file) theme_free(&theme);
+
+    if(out) write_ppm(out, bb);
+
+    free(tiles);
+    free(centres);
+
+    return 0;
+}
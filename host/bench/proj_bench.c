@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "map.h"
+#include "proj.h"
+#include "way.h"
+#include "prof.h"
+
+// Checks the fixed point projection against the float path it replaced and
+// against exact Web-Mercator, and times both per node.
+
+#define N_NODES (1 << 18)
+
+static int32_t lat_md[N_NODES];
+static int32_t lon_md[N_NODES];
+static int32_t out[N_NODES];
+
+static double mercator_y(double lat) {
+    return log(tan(M_PI/4 + lat*M_PI/360.0));
+}
+
+int main(int argc, char ** argv) {
+    double lat = (argc > 1) ? atof(argv[1]) : 55.918430;
+    double lon = (argc > 2) ? atof(argv[2]) : -3.240967;
+    float size = (argc > 3) ? atof(argv[3]) : 128;
+    int64_t sink = 0;
+
+    printf("%4s %10s %10s %10s %10s %10s %10s\n", "zoom", "err lat", "err lon", "err merc",
+        "float ns", "fixed ns", "merc ns");
+
+    for(int z = 5; z <= 18; z++) {
+        uint32_t x = long2tilex(lon, z);
+        uint32_t y = lat2tiley(lat, z);
+
+        float scale, x_scale;
+        map_tile_fit(x, y, z, size, &scale, &x_scale);
+
+        double lat0 = tiley2lat(y, z);
+        double lat1 = tiley2lat(y+1, z);
+        double span_lat = (lat0 - lat1)*1000000.0;
+        double span_lon = (tilex2long(x+1, z) - tilex2long(x, z))*1000000.0;
+
+        proj_t pj;
+        proj_init(&pj, scale, x_scale);
+        proj_init_mercator(&pj, lat0, lat1, size);
+
+        // Nodes are offsets from the tile's top left, ways run a little past its edges.
+        srand(z);
+        for(int n = 0; n < N_NODES; n++) {
+            lat_md[n] = -span_lat*(rand()/(double)RAND_MAX*1.2 - 0.1);
+            lon_md[n] = span_lon*(rand()/(double)RAND_MAX*1.2 - 0.1);
+        }
+
+        int err_lat = 0, err_lon = 0, err_merc = 0;
+        double m0 = mercator_y(lat0);
+        double k = size/(m0 - mercator_y(lat1));
+
+        for(int n = 0; n < N_NODES; n++) {
+            int e = abs(-lat_to_y(lat_md[n], scale) - proj_lat(&pj, lat_md[n]));
+            if(e > err_lat) err_lat = e;
+
+            e = abs(lon_to_x(lon_md[n], x_scale) - proj_lon(&pj, lon_md[n]));
+            if(e > err_lon) err_lon = e;
+
+            int32_t merc = (m0 - mercator_y(lat0 + lat_md[n]/1000000.0))*k;
+            e = abs(merc - proj_lat_mercator(&pj, lat_md[n]));
+            if(e > err_merc) err_merc = e;
+        }
+
+        uint64_t t0 = prof_time_us();
+        for(int n = 0; n < N_NODES; n++) {
+            out[n] = -lat_to_y(lat_md[n], scale) + lon_to_x(lon_md[n], x_scale);
+        }
+        uint64_t float_us = prof_time_us() - t0;
+        sink += out[z];
+
+        t0 = prof_time_us();
+        for(int n = 0; n < N_NODES; n++) {
+            out[n] = proj_lat(&pj, lat_md[n]) + proj_lon(&pj, lon_md[n]);
+        }
+        uint64_t fixed_us = prof_time_us() - t0;
+        sink += out[z];
+
+        t0 = prof_time_us();
+        for(int n = 0; n < N_NODES; n++) {
+            out[n] = proj_lat_mercator(&pj, lat_md[n]) + proj_lon(&pj, lon_md[n]);
+        }
+        uint64_t merc_us = prof_time_us() - t0;
+        sink += out[z];
+
+        printf("%4d %10d %10d %10d %10.2f %10.2f %10.2f\n", z, err_lat, err_lon, err_merc,
+            float_us*1000.0/N_NODES, fixed_us*1000.0/N_NODES, merc_us*1000.0/N_NODES);
+    }
+
+    if(sink == 0x7fffffff) printf("\n");
+
+    return 0;
+}
@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "parse.h"
+#include "prof.h"
+
+// Compares get_vbe_int() one value at a time against decode_vbe_int_run()
+// over synthetic coordinate delta streams.
+
+#define N_VALUES (1 << 20)
+
+// Mapsforge signed varint, sign in bit 6 of the last byte.
+static size_t put_vbe_int(uint8_t * p, int32_t v) {
+    uint32_t mag = (v < 0) ? -(uint32_t)v : (uint32_t)v;
+    size_t len = 0;
+
+    while(mag > 0x3f) {
+        p[len++] = (mag & 0x7f) | 0x80;
+        mag >>= 7;
+    }
+    p[len++] = mag | ((v < 0) ? 0x40 : 0);
+
+    return len;
+}
+
+// Share of values drawn from 1-, 2-, 3- and 4-byte ranges, in percent.
+typedef struct {
+    const char * name;
+    int mix[4];
+} mix_t;
+
+static const mix_t mixes[] = {
+    { "1-byte only", {100,  0,  0, 0} },
+    { "way deltas",  { 60, 35,  4, 1} },
+    { "2-byte only", {  0, 100, 0, 0} },
+    { "wide",        { 10, 30, 40, 20} },
+};
+
+static int32_t random_value(const int * mix) {
+    static const int32_t range[4] = {0x3f, 0x1fff, 0xfffff, 0x7ffffff};
+    int r = rand() % 100;
+    int b = 0;
+
+    while(b < 3 && r >= mix[b]) r -= mix[b++];
+
+    int32_t v = rand() % (range[b] + 1);
+    return (rand() & 1) ? -v : v;
+}
+
+int main(int argc, char ** argv) {
+    int iterations = (argc > 1) ? atoi(argv[1]) : 20;
+
+    int32_t * values = malloc(sizeof(int32_t)*N_VALUES);
+    int32_t * out = malloc(sizeof(int32_t)*N_VALUES);
+    uint8_t * stream = malloc(VBE_INT_MAX_BYTES*N_VALUES);
+
+    printf("%-12s %8s %12s %12s %8s\n", "stream", "bytes/v", "single ns/v", "run ns/v", "speedup");
+
+    for(size_t m = 0; m < sizeof(mixes)/sizeof(mixes[0]); m++) {
+        srand(1);
+
+        size_t len = 0;
+        for(int i = 0; i < N_VALUES; i++) {
+            values[i] = random_value(mixes[m].mix);
+            len += put_vbe_int(stream + len, values[i]);
+        }
+
+        uint64_t single_us = 0;
+        uint64_t run_us = 0;
+        int64_t check = 0;
+
+        for(int it = 0; it < iterations; it++) {
+            cursor_t c = { stream, stream + len, 0 };
+
+            uint64_t t0 = prof_time_us();
+            for(int i = 0; i < N_VALUES; i++) {
+                out[i] = get_vbe_int(&c);
+            }
+            single_us += prof_time_us() - t0;
+            check += out[it % N_VALUES];
+
+            c.ptr = stream;
+
+            t0 = prof_time_us();
+            size_t n = decode_vbe_int_run(&c, out, N_VALUES);
+            run_us += prof_time_us() - t0;
+
+            if(n != N_VALUES || c.ptr != c.end || memcmp(out, values, sizeof(int32_t)*N_VALUES)) {
+                fprintf(stderr, "%s: run decode mismatch\n", mixes[m].name);
+                return 1;
+            }
+        }
+
+        double total = (double)N_VALUES*iterations;
+        printf("%-12s %8.2f %12.2f %12.2f %7.2fx\n", mixes[m].name, (double)len/N_VALUES,
+            single_us*1000.0/total, run_us*1000.0/total, (double)single_us/run_us);
+
+        if(check == 0x7fffffff) printf("\n");
+    }
+
+    free(values);
+    free(out);
+    free(stream);
+
+    return 0;
+}
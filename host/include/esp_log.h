@@ -0,0 +1,13 @@
+#ifndef ESP_LOG_SHIM_GUARD
+#define ESP_LOG_SHIM_GUARD
+
+// Minimal stand-in for ESP-IDF logging so mapmini builds on the host.
+#include <stdio.h>
+
+#define ESP_LOGE(tag, fmt, ...) fprintf(stderr, "E (%s) " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) fprintf(stderr, "W (%s) " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) fprintf(stderr, "I (%s) " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGD(tag, fmt, ...) do { } while(0)
+#define ESP_LOGV(tag, fmt, ...) do { } while(0)
+
+#endif
@@ -0,0 +1,61 @@
+#include "hagl_hal.h"
+
+#include <string.h>
+#include <bitmap.h>
+#include <hagl.h>
+
+// Memory backed HAL, mirrors the 8-bit framebuffer layout of hagl_hal.c
+// without any display attached.
+uint8_t buffer1[DISPLAY_WIDTH*DISPLAY_HEIGHT];
+
+static bitmap_t fb = {
+    .width = DISPLAY_WIDTH,
+    .height = DISPLAY_HEIGHT,
+    .depth = DISPLAY_DEPTH,
+};
+
+static bitmap_t *target = &fb;
+
+bitmap_t *hagl_hal_init()
+{
+    bitmap_init(&fb, buffer1);
+
+    return &fb;
+}
+
+bitmap_t *hagl_hal_set_target(bitmap_t *bitmap)
+{
+    bitmap_t *previous = target;
+
+    target = bitmap ? bitmap : &fb;
+    return previous;
+}
+
+size_t hagl_hal_flush()
+{
+    return DISPLAY_WIDTH*DISPLAY_HEIGHT;
+}
+
+void hagl_hal_put_pixel(int16_t x0, int16_t y0, color_t color)
+{
+    target->buffer[target->pitch*y0 + x0] = color;
+}
+
+color_t hagl_hal_color(uint8_t r, uint8_t g, uint8_t b) {
+    return (((255-r) & 0xe0) >> 6 | ((255-g) & 0xe0) >> 2 | ((255-b) & 0xc0));
+}
+
+void hagl_hal_hline(int16_t x0, int16_t y0, uint16_t width, color_t color)
+{
+    memset(&target->buffer[target->pitch*y0 + x0], color, width);
+}
+
+void hagl_hal_vline(int16_t x0, int16_t y0, uint16_t height, color_t color)
+{
+    uint8_t *ptr = target->buffer + target->pitch*y0 + x0;
+    uint32_t pitch = target->pitch;
+
+    for (uint16_t y = 0; y < height; y++) {
+        ptr[pitch*y] = color;
+    }
+}
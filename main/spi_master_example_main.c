@@ -32,9 +32,20 @@
 #include "map.h"
 #include "rgb332.h"
 #include "memory.h"
+#include "tile_cache.h"
+#include "viewport.h"
+#include "prefetch.h"
 
 static const char *TAG = "main";
 
+#define MAP_CACHE_SLOTS 6
+#define MAP_CACHE_SLOT_SIZE 24000
+
+// The map is drawn north up into a square texture this wide and each
+// frame is turned out of it, so only panning past the spare border around
+// the screen's diagonal draws ways again. 0 draws every frame instead.
+#define MAP_TEXTURE_SIZE 200
+
 static SemaphoreHandle_t mutex;
 static float fb_fps;
 static float fx_fps;
@@ -126,24 +137,102 @@ void app_main()
 
     float rot = 0.0;
 
-    way_prop* way_list_ptr = NULL;
+    static map_handle_t mh;
+    if(open_map(&mh, "/sdcard/scotland_roads.map")) {
+        ESP_LOGE(TAG, "Failed to open map");
+        return;
+    }
+
+    mh.pois = 1;
+
+    // Optional, the built in rules are used without it.
+    static theme_t theme;
+    const theme_t * th = NULL;
+    if(theme_load(&theme, "/sdcard/theme.txt") == 0 && map_set_theme(&mh, &theme) == 0) {
+        th = &theme;
+    }
+
+    static tile_cache_t tc;
+    if(tile_cache_init(&tc, MAP_CACHE_SLOTS, PREFETCH_BUFFERS, MAP_CACHE_SLOT_SIZE)) {
+        ESP_LOGE(TAG, "Failed to allocate tile cache");
+        return;
+    }
+
+    ESP_LOGI(TAG, "Heap after tile cache init: %d", esp_get_free_heap_size());
+
+    static prefetcher_t pf;
+    if(prefetch_start(&pf, "/sdcard/scotland_roads.map", &tc, th)) {
+        ESP_LOGW(TAG, "Prefetch disabled");
+    }
+    pf.mh.pois = mh.pois;
+
+    ESP_LOGI(TAG, "Heap after prefetch init: %d", esp_get_free_heap_size());
+
+    // Centre of tile 14/8044/5108
+    int32_t lat = 55918430;
+    int32_t lon = -3240967;
 
-    arena_t a0;
-    arena_init(&a0, ARENA_DEFAULT_SIZE);
+    static viewport_t vp;
 
-    uint8_t wd = load_map(&a0, "/sdcard/scotland_roads.map", &way_list_ptr, 8044, 5108, 14, 0, 0, 0xFFFF, 0, 128);   
+    static bitmap_t tex = {
+        .width = MAP_TEXTURE_SIZE,
+        .height = MAP_TEXTURE_SIZE,
+        .depth = DISPLAY_DEPTH,
+    };
+    uint8_t * tex_buf = NULL;
+    if(MAP_TEXTURE_SIZE) tex_buf = malloc(MAP_TEXTURE_SIZE*MAP_TEXTURE_SIZE);
+    if(tex_buf) bitmap_init(&tex, tex_buf);
+    else if(MAP_TEXTURE_SIZE) ESP_LOGW(TAG, "No room for map texture, drawing every frame");
 
-    ESP_LOGI(TAG, "Loaded in %d ways", wd);
-    ESP_LOGI(TAG, "Allocated: %d", a0.current);
+    ESP_LOGI(TAG, "Heap after texture init: %d", esp_get_free_heap_size());
+
+    // How far the centre can move from where the texture was drawn before
+    // the turned screen's corners would fall off it.
+    float tex_slack = (MAP_TEXTURE_SIZE-hypotf(DISPLAY_WIDTH, DISPLAY_HEIGHT))/2-1;
 
     while(1) {
 
-        vTaskDelay(1);
-        xSemaphoreTake(mutex, portMAX_DELAY);
-        hagl_clear_screen();
-        
-        for(int w = 0; w < wd; w++) {
-            g_draw_way(way_list_ptr+w, 0, 0, 0, 0, rot, 128);
+        prefetch_poll(&pf, &tc);
+
+        if(!tex_buf) {
+            viewport_load(&vp, &tc, &mh, lat, lon, 14, DISPLAY_WIDTH, DISPLAY_HEIGHT, rot, 128);
+            // Drifting east
+            prefetch_update(&pf, &tc, &vp, M_PI/2);
+
+            vTaskDelay(1);
+            xSemaphoreTake(mutex, portMAX_DELAY);
+            hagl_clear_screen();
+
+            viewport_draw(&vp);
+        } else {
+            float dx = 0;
+            float dy = 0;
+            if(vp.n_tiles) viewport_offset(&vp, lat, lon, &dx, &dy);
+
+            // Flushing only reads the back buffer, so the texture is drawn
+            // without holding the mutex.
+            if(vp.n_tiles == 0 || fabsf(dx) > tex_slack || fabsf(dy) > tex_slack) {
+                viewport_load(&vp, &tc, &mh, lat, lon, 14, MAP_TEXTURE_SIZE, MAP_TEXTURE_SIZE, 0, 128);
+                // Drifting east
+                prefetch_update(&pf, &tc, &vp, M_PI/2);
+
+                memset(tex.buffer, 0x00, tex.size);
+                hagl_hal_set_target(&tex);
+                hagl_set_clip_window(0, 0, MAP_TEXTURE_SIZE-1, MAP_TEXTURE_SIZE-1);
+                viewport_draw(&vp);
+                hagl_hal_set_target(NULL);
+                hagl_set_clip_window(1, 1, DISPLAY_WIDTH-1, DISPLAY_HEIGHT-1);
+                dx = 0;
+                dy = 0;
+            }
+
+            vTaskDelay(1);
+            xSemaphoreTake(mutex, portMAX_DELAY);
+
+            // Every screen pixel lands on the texture, so nothing needs clearing.
+            bitmap_affine_t m;
+            bitmap_affine_rotate(&m, rot, 1.0f, MAP_TEXTURE_SIZE/2.0f+dx, MAP_TEXTURE_SIZE/2.0f+dy, DISPLAY_WIDTH/2.0f, DISPLAY_HEIGHT/2.0f);
+            bitmap_affine_blit(&m, BITMAP_SAMPLE_NEAREST, &tex, bb);
         }
 
         uint16_t compass_len = 10;
@@ -162,6 +251,7 @@ void app_main()
         //ESP_LOGI(TAG,"Loaded %d bytes from map", hp);
         
         rot += M_PI/157;
+        lon += 40;
         
     }
 }
\ No newline at end of file